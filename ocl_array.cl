@@ -0,0 +1,103 @@
+// kernels of [ocl_array] : element-wise operations, SAXPY and reductions
+// on float arrays of n elements. the global size may be larger than n.
+
+// dst = a <op> b
+#define BINARY(name, expr) \
+__kernel void name##_kernel(__global float *dst, \
+                            __global const float *a, \
+                            __global const float *b, \
+                            const uint n) \
+{ \
+  uint i = get_global_id(0); \
+  if ( i >= n ) return; \
+  float x = a[i]; \
+  float y = b[i]; \
+  dst[i] = expr; \
+} \
+__kernel void name##_scalar_kernel(__global float *dst, \
+                                   __global const float *a, \
+                                   const float y, \
+                                   const uint n) \
+{ \
+  uint i = get_global_id(0); \
+  if ( i >= n ) return; \
+  float x = a[i]; \
+  dst[i] = expr; \
+}
+
+BINARY(add, x + y)
+BINARY(sub, x - y)
+BINARY(mul, x * y)
+BINARY(div, x / y)
+BINARY(min, fmin(x, y))
+BINARY(max, fmax(x, y))
+
+// dst = <op>(a)
+#define UNARY(name, expr) \
+__kernel void name##_kernel(__global float *dst, \
+                            __global const float *a, \
+                            const uint n) \
+{ \
+  uint i = get_global_id(0); \
+  if ( i >= n ) return; \
+  float x = a[i]; \
+  dst[i] = expr; \
+}
+
+UNARY(abs, fabs(x))
+UNARY(sqrt, sqrt(x))
+UNARY(exp, exp(x))
+UNARY(log, log(x))
+UNARY(tanh, tanh(x))
+
+// y = alpha * x + y
+__kernel void saxpy_kernel(__global float *y,
+                           const float alpha,
+                           __global const float *x,
+                           const uint n)
+{
+  uint i = get_global_id(0);
+  if ( i >= n ) return;
+  y[i] = alpha * x[i] + y[i];
+}
+
+// work-group size of the reductions (OCL_ARRAY_GROUP_SIZE on the host)
+#ifndef GROUP_SIZE
+#define GROUP_SIZE 64
+#endif
+
+// one partial result per work-group : every work-item folds a strided
+// share of the array, then the group folds its work-items in local memory.
+// the host folds the partials. b is only read by dot, pass a for the others
+#define REDUCE(name, init, load, combine) \
+__kernel __attribute__((reqd_work_group_size(GROUP_SIZE, 1, 1))) \
+void reduce_##name##_kernel(__global const float *a, \
+                            __global const float *b, \
+                            __global float *partial, \
+                            const uint n) \
+{ \
+  __local float scratch[GROUP_SIZE]; \
+  uint lid = get_local_id(0); \
+  float acc = init; \
+  for ( uint i = get_global_id(0); i < n; i += get_global_size(0) ){ \
+    float x = load; \
+    acc = combine; \
+  } \
+  scratch[lid] = acc; \
+  barrier(CLK_LOCAL_MEM_FENCE); \
+  for ( uint s = GROUP_SIZE / 2; s > 0; s >>= 1 ){ \
+    if ( lid < s ){ \
+      float x = scratch[lid + s]; \
+      acc = scratch[lid]; \
+      scratch[lid] = combine; \
+    } \
+    barrier(CLK_LOCAL_MEM_FENCE); \
+  } \
+  if ( lid == 0 ) partial[get_group_id(0)] = scratch[0]; \
+}
+
+REDUCE(sum,   0.0f,      a[i],        acc + x)
+REDUCE(sumsq, 0.0f,      a[i] * a[i], acc + x)
+REDUCE(dot,   0.0f,      a[i] * b[i], acc + x)
+REDUCE(min,   INFINITY,  a[i],        fmin(acc, x))
+REDUCE(max,   -INFINITY, a[i],        fmax(acc, x))
@@ -0,0 +1,401 @@
+////////////////////////////////////////////////////////
+//
+// GEM - Graphics Environment for Multimedia
+//
+// zmoelnig@iem.kug.ac.at
+//
+// Implementation file
+//
+//    Copyright (c) 1997-2000 Mark Danks.
+//    Copyright (c) Günther Geiger.
+//    Copyright (c) 2001-2011 IOhannes m zmölnig. forum::für::umläute. IEM. zmoelnig@iem.at
+//    For information on usage and redistribution, and for a DISCLAIMER OF ALL
+//    WARRANTIES, see the file, "GEM.LICENSE.TERMS" in this distribution.
+//
+/////////////////////////////////////////////////////////
+
+#include "ocl_array.hpp"
+
+#include <cstring>
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+
+CPPEXTERN_NEW(ocl_array);
+
+/////////////////////////////////////////////////////////
+//
+// ocl_array
+//
+/////////////////////////////////////////////////////////
+// Constructor
+//
+/////////////////////////////////////////////////////////
+ocl_array :: ocl_array(void)
+        : m_runtime(NULL),
+        m_program(0),
+        m_partialMem(0)
+{
+  // no GL : arrays are processed outside of the render chain
+  m_runtime = oclRuntime::acquire(false);
+  if ( m_runtime == NULL )
+    throw(GemException("Failed to create OpenCL context."));
+
+  m_dataOut = outlet_new(this->x_obj, 0);
+}
+
+/////////////////////////////////////////////////////////
+// Destructor
+//
+/////////////////////////////////////////////////////////
+ocl_array :: ~ocl_array()
+{
+  clearMess();
+  m_pool.put(m_partialMem);
+  m_pool.clear();
+  if ( m_program )
+    m_runtime->releaseProgram(m_program);
+  oclRuntime::release(m_runtime);
+}
+
+///
+// Build the kernels on first use : messages are handled right away, so
+// this one waits for the compiler (or the binary cache)
+bool ocl_array :: initOpenCL()
+{
+  if ( m_program ) return true;
+  std::ostringstream options;
+  options << "-DGROUP_SIZE=" << OCL_ARRAY_GROUP_SIZE;
+  m_program = m_runtime->getProgramFromFile(findFile("ocl_array.cl").c_str(), options.str());
+  if ( m_program == NULL ){
+    error("Failed to create OpenCL program.");
+    return false;
+  }
+  return true;
+}
+
+cl_kernel ocl_array :: kernel(const std::string &name)
+{
+  cl_kernel k = m_runtime->getKernel(m_program, name.c_str());
+  if ( k == NULL ) error("Failed to create kernel %s", name.c_str());
+  return k;
+}
+
+t_garray *ocl_array :: findArray(t_symbol *name, t_word **vec, int *size)
+{
+  t_garray *a = (t_garray *)pd_findbyclass(name, garray_class);
+  if ( a == NULL ){
+    error("%s: no such array", name->s_name);
+    return NULL;
+  }
+  if ( !garray_getfloatwords(a, size, vec) ){
+    error("%s: bad template for ocl_array", name->s_name);
+    return NULL;
+  }
+  return a;
+}
+
+size_t ocl_array :: arraySize(t_symbol *name)
+{
+  t_word *vec;
+  int size = 0;
+  return findArray(name, &vec, &size) ? size : 0;
+}
+
+///
+// Upload the range of elements that differs from the host copy of the
+// buffer : after the first time, only what was edited in Pd is sent
+cl_mem ocl_array :: upload(t_symbol *name)
+{
+  t_word *vec;
+  int size = 0;
+  if ( !findArray(name, &vec, &size) || size < 1 ) return 0;
+  size_t n = size;
+
+  deviceArray &array = m_arrays[name];
+  if ( array.mem && array.capacity < n ){
+    // grown : a bigger buffer, uploaded as a whole
+    m_pool.put(array.mem);
+    array.mem = 0;
+  }
+  if ( !array.mem ){
+    array.mem = m_pool.get(m_runtime->context(), CL_MEM_READ_WRITE, n * sizeof(cl_float));
+    if ( array.mem == NULL ){
+      error("%s: Error creating buffer of %d elements.", name->s_name, size);
+      m_arrays.erase(name);
+      return 0;
+    }
+    array.capacity = n;
+    array.shadow.clear();
+  }
+
+  std::vector<float> &shadow = array.shadow;
+  size_t common = std::min(shadow.size(), n);
+  size_t first = 0, last = common;
+  while ( first < common && !memcmp(&shadow[first], &vec[first].w_float, sizeof(float)) ) first++;
+  while ( last > first && !memcmp(&shadow[last-1], &vec[last-1].w_float, sizeof(float)) ) last--;
+  // grown within the capacity : the new elements too
+  if ( n > common ){
+    if ( first == last ) first = common;
+    last = n;
+  }
+  shadow.resize(n);
+  if ( first == last ) return array.mem;
+
+  for ( size_t i = first; i < last; i++ ) shadow[i] = vec[i].w_float;
+  // blocking : the driver may read the shadow until the write is done, and
+  // the next diff or resize changes it. only the changed range goes anyway
+  cl_int errNum = clEnqueueWriteBuffer(m_runtime->queue(), array.mem, CL_TRUE,
+                                       first * sizeof(cl_float), (last - first) * sizeof(cl_float),
+                                       &shadow[first], 0, NULL, NULL);
+  if ( errNum != CL_SUCCESS ){
+    error("%s: Error writing buffer.", name->s_name);
+    array.shadow.clear();
+    return 0;
+  }
+  return array.mem;
+}
+
+bool ocl_array :: download(t_symbol *name, size_t n)
+{
+  t_word *vec;
+  int size = 0;
+  t_garray *a = findArray(name, &vec, &size);
+  deviceArray &array = m_arrays[name];
+  if ( !a || !array.mem || (size_t)size < n || array.shadow.size() < n ) return false;
+
+  cl_int errNum = clEnqueueReadBuffer(m_runtime->queue(), array.mem, CL_TRUE, 0, n * sizeof(cl_float),
+                                      &array.shadow[0], 0, NULL, NULL);
+  if ( errNum != CL_SUCCESS ){
+    error("%s: Error reading buffer.", name->s_name);
+    array.shadow.clear();
+    return false;
+  }
+  for ( size_t i = 0; i < n; i++ ) vec[i].w_float = array.shadow[i];
+  garray_redraw(a);
+  return true;
+}
+
+///
+// One work-item per element : the global size is padded, the kernels
+// check against n
+bool ocl_array :: enqueue(cl_kernel kernel, size_t n)
+{
+  size_t global = (n + OCL_ARRAY_GROUP_SIZE - 1) / OCL_ARRAY_GROUP_SIZE * OCL_ARRAY_GROUP_SIZE;
+  cl_int errNum = clEnqueueNDRangeKernel(m_runtime->queue(), kernel, 1, NULL, &global, NULL, 0, NULL, NULL);
+  if ( errNum != CL_SUCCESS ){
+    error("Error queuing kernel for execution (%d).", errNum);
+    return false;
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////////
+// static member function
+//
+/////////////////////////////////////////////////////////
+void ocl_array :: obj_setupCallback(t_class *classPtr){
+  CPPEXTERN_MSG (classPtr, "add", binaryMess);
+  CPPEXTERN_MSG (classPtr, "sub", binaryMess);
+  CPPEXTERN_MSG (classPtr, "mul", binaryMess);
+  CPPEXTERN_MSG (classPtr, "div", binaryMess);
+  // 'min <a>' and 'max <a>' are reductions
+  CPPEXTERN_MSG (classPtr, "min", binaryMess);
+  CPPEXTERN_MSG (classPtr, "max", binaryMess);
+
+  CPPEXTERN_MSG (classPtr, "abs", unaryMess);
+  CPPEXTERN_MSG (classPtr, "sqrt", unaryMess);
+  CPPEXTERN_MSG (classPtr, "exp", unaryMess);
+  CPPEXTERN_MSG (classPtr, "log", unaryMess);
+  CPPEXTERN_MSG (classPtr, "tanh", unaryMess);
+
+  CPPEXTERN_MSG (classPtr, "saxpy", saxpyMess);
+
+  CPPEXTERN_MSG (classPtr, "sum", reduceMess);
+  CPPEXTERN_MSG (classPtr, "rms", reduceMess);
+  CPPEXTERN_MSG (classPtr, "dot", reduceMess);
+
+  CPPEXTERN_MSG0(classPtr, "clear", clearMess);
+}
+
+void ocl_array :: binaryMess(t_symbol*s, int argc, t_atom*argv)
+{
+  if ( argc == 1 && ( s == gensym("min") || s == gensym("max") ) ){
+    reduceMess(s, argc, argv);
+    return;
+  }
+  if ( argc != 3 || argv[0].a_type != A_SYMBOL || argv[1].a_type != A_SYMBOL ){
+    error("arguments: %s <dst> <a> <b|float>", s->s_name);
+    return;
+  }
+  if ( !initOpenCL() ) return;
+  t_symbol *dst = atom_getsymbol(argv+0);
+  t_symbol *a = atom_getsymbol(argv+1);
+  bool scalar = ( argv[2].a_type == A_FLOAT );
+  t_symbol *b = scalar ? NULL : atom_getsymbol(argv+2);
+
+  size_t n = std::min(arraySize(dst), arraySize(a));
+  if ( b ) n = std::min(n, arraySize(b));
+  if ( n == 0 ) return;
+
+  cl_mem aMem = upload(a);
+  cl_mem bMem = b ? upload(b) : 0;
+  cl_mem dstMem = upload(dst);
+  if ( !aMem || !dstMem || ( b && !bMem ) ) return;
+
+  cl_kernel k = kernel(std::string(s->s_name) + ( scalar ? "_scalar_kernel" : "_kernel" ));
+  if ( k == NULL ) return;
+  cl_uint count = n;
+  cl_float y = atom_getfloat(argv+2);
+  cl_int errNum = clSetKernelArg(k, 0, sizeof(cl_mem), &dstMem);
+  errNum |= clSetKernelArg(k, 1, sizeof(cl_mem), &aMem);
+  if ( scalar ) errNum |= clSetKernelArg(k, 2, sizeof(cl_float), &y);
+  else          errNum |= clSetKernelArg(k, 2, sizeof(cl_mem), &bMem);
+  errNum |= clSetKernelArg(k, 3, sizeof(cl_uint), &count);
+  if ( errNum != CL_SUCCESS ){
+    error("Error setting kernel arguments.");
+    return;
+  }
+  if ( enqueue(k, n) ) download(dst, n);
+}
+
+void ocl_array :: unaryMess(t_symbol*s, int argc, t_atom*argv)
+{
+  if ( argc != 2 || argv[0].a_type != A_SYMBOL || argv[1].a_type != A_SYMBOL ){
+    error("arguments: %s <dst> <a>", s->s_name);
+    return;
+  }
+  if ( !initOpenCL() ) return;
+  t_symbol *dst = atom_getsymbol(argv+0);
+  t_symbol *a = atom_getsymbol(argv+1);
+  size_t n = std::min(arraySize(dst), arraySize(a));
+  if ( n == 0 ) return;
+
+  cl_mem aMem = upload(a);
+  cl_mem dstMem = upload(dst);
+  if ( !aMem || !dstMem ) return;
+
+  cl_kernel k = kernel(std::string(s->s_name) + "_kernel");
+  if ( k == NULL ) return;
+  cl_uint count = n;
+  cl_int errNum = clSetKernelArg(k, 0, sizeof(cl_mem), &dstMem);
+  errNum |= clSetKernelArg(k, 1, sizeof(cl_mem), &aMem);
+  errNum |= clSetKernelArg(k, 2, sizeof(cl_uint), &count);
+  if ( errNum != CL_SUCCESS ){
+    error("Error setting kernel arguments.");
+    return;
+  }
+  if ( enqueue(k, n) ) download(dst, n);
+}
+
+void ocl_array :: saxpyMess(t_symbol*s, int argc, t_atom*argv)
+{
+  if ( argc != 3 || argv[0].a_type != A_SYMBOL || argv[2].a_type != A_SYMBOL ){
+    error("arguments: saxpy <y> <alpha> <x>");
+    return;
+  }
+  if ( !initOpenCL() ) return;
+  t_symbol *y = atom_getsymbol(argv+0);
+  cl_float alpha = atom_getfloat(argv+1);
+  t_symbol *x = atom_getsymbol(argv+2);
+  size_t n = std::min(arraySize(y), arraySize(x));
+  if ( n == 0 ) return;
+
+  cl_mem xMem = upload(x);
+  cl_mem yMem = upload(y);
+  if ( !xMem || !yMem ) return;
+
+  cl_kernel k = kernel("saxpy_kernel");
+  if ( k == NULL ) return;
+  cl_uint count = n;
+  cl_int errNum = clSetKernelArg(k, 0, sizeof(cl_mem), &yMem);
+  errNum |= clSetKernelArg(k, 1, sizeof(cl_float), &alpha);
+  errNum |= clSetKernelArg(k, 2, sizeof(cl_mem), &xMem);
+  errNum |= clSetKernelArg(k, 3, sizeof(cl_uint), &count);
+  if ( errNum != CL_SUCCESS ){
+    error("Error setting kernel arguments.");
+    return;
+  }
+  if ( enqueue(k, n) ) download(y, n);
+}
+
+///
+// Each work-group folds its share into one partial, the host folds the
+// partials in double precision
+void ocl_array :: reduceMess(t_symbol*s, int argc, t_atom*argv)
+{
+  bool dot = ( s == gensym("dot") );
+  if ( argc != ( dot ? 2 : 1 ) || argv[0].a_type != A_SYMBOL || ( dot && argv[1].a_type != A_SYMBOL ) ){
+    error(dot ? "arguments: dot <a> <b>" : "arguments: %s <a>", s->s_name);
+    return;
+  }
+  if ( !initOpenCL() ) return;
+  t_symbol *a = atom_getsymbol(argv+0);
+  t_symbol *b = dot ? atom_getsymbol(argv+1) : a;
+  size_t n = std::min(arraySize(a), arraySize(b));
+  if ( n == 0 ) return;
+
+  cl_mem aMem = upload(a);
+  cl_mem bMem = dot ? upload(b) : aMem;
+  if ( !aMem || !bMem ) return;
+
+  if ( !m_partialMem ){
+    m_partialMem = m_pool.get(m_runtime->context(), CL_MEM_READ_WRITE, OCL_ARRAY_GROUPS * sizeof(cl_float));
+    if ( m_partialMem == NULL ){
+      std::cerr << "Error creating memory objects." << std::endl;
+      return;
+    }
+  }
+
+  std::string op = s->s_name;
+  if ( op == "rms" ) op = "sumsq";
+  cl_kernel k = kernel("reduce_" + op + "_kernel");
+  if ( k == NULL ) return;
+  cl_uint count = n;
+  cl_int errNum = clSetKernelArg(k, 0, sizeof(cl_mem), &aMem);
+  errNum |= clSetKernelArg(k, 1, sizeof(cl_mem), &bMem);
+  errNum |= clSetKernelArg(k, 2, sizeof(cl_mem), &m_partialMem);
+  errNum |= clSetKernelArg(k, 3, sizeof(cl_uint), &count);
+  if ( errNum != CL_SUCCESS ){
+    error("Error setting kernel arguments.");
+    return;
+  }
+
+  size_t groups = std::min((size_t)OCL_ARRAY_GROUPS, (n + OCL_ARRAY_GROUP_SIZE - 1) / OCL_ARRAY_GROUP_SIZE);
+  size_t global = groups * OCL_ARRAY_GROUP_SIZE;
+  size_t local = OCL_ARRAY_GROUP_SIZE;
+  errNum = clEnqueueNDRangeKernel(m_runtime->queue(), k, 1, NULL, &global, &local, 0, NULL, NULL);
+  if ( errNum != CL_SUCCESS ){
+    error("Error queuing kernel for execution (%d).", errNum);
+    return;
+  }
+  cl_float partial[OCL_ARRAY_GROUPS];
+  errNum = clEnqueueReadBuffer(m_runtime->queue(), m_partialMem, CL_TRUE, 0, groups * sizeof(cl_float),
+                               partial, 0, NULL, NULL);
+  if ( errNum != CL_SUCCESS ){
+    error("Error reading result buffer.");
+    return;
+  }
+
+  double result = partial[0];
+  for ( size_t i = 1; i < groups; i++ ){
+    if ( s == gensym("min") )      result = std::min(result, (double)partial[i]);
+    else if ( s == gensym("max") ) result = std::max(result, (double)partial[i]);
+    else                           result += partial[i];
+  }
+  if ( s == gensym("rms") ) result = sqrt(result / n);
+
+  t_atom ap[1];
+  SETFLOAT(ap, result);
+  outlet_anything(m_dataOut, s, 1, ap);
+}
+
+void ocl_array :: clearMess(void)
+{
+  std::map<t_symbol*, deviceArray>::iterator it;
+  for ( it = m_arrays.begin(); it != m_arrays.end(); ++it )
+    m_pool.put(it->second.mem);
+  m_arrays.clear();
+  // nothing kept around for later
+  m_pool.clear();
+}
@@ -0,0 +1,114 @@
+/*-----------------------------------------------------------------
+LOG
+    GEM - Graphics Environment for Multimedia
+
+    ocl_array - OpenCL operations on Pd arrays
+
+    Copyright (c) 1997-2000 Mark Danks. mark@danks.org
+    Copyright (c) Günther Geiger. geiger@epy.co.at
+    Copyright (c) 2001-2011 IOhannes m zmölnig. forum::für::umläute. IEM. zmoelnig@iem.at
+    For information on usage and redistribution, and for a DISCLAIMER OF ALL
+    WARRANTIES, see the file, "GEM.LICENSE.TERMS" in this distribution.
+
+-----------------------------------------------------------------*/
+
+#ifndef _INCLUDE__GEM_OCL_ARRAY_H_
+#define _INCLUDE__GEM_OCL_ARRAY_H_
+
+#include "Base/CPPExtern.h"
+#include "Gem/Exception.h"
+
+#include "ocl_runtime.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+
+// work-group size of the reductions (GROUP_SIZE in the kernels)
+#define OCL_ARRAY_GROUP_SIZE 64
+// most work-groups of a reduction, each folds a strided share of the array
+#define OCL_ARRAY_GROUPS 256
+
+
+/*-----------------------------------------------------------------
+-------------------------------------------------------------------
+CLASS
+    ocl_array
+
+    element-wise operations, SAXPY and reductions on Pd arrays
+
+KEYWORDS
+    array
+
+DESCRIPTION
+
+    every array keeps a device buffer between messages, grown when the
+    array grows, and a host copy of what the buffer holds : only the range
+    of elements that changed in Pd since the last message is uploaded.
+    operations run on the first n elements, n being the size of the
+    smallest array involved.
+
+    add|sub|mul|div|min|max <dst> <a> <b|float>
+    abs|sqrt|exp|log|tanh <dst> <a>
+    saxpy <y> <alpha> <x> : y = alpha * x + y
+    sum|min|max|rms <a>, dot <a> <b> : the result goes out as
+        <op> <value>
+    clear : release the device buffers
+
+-----------------------------------------------------------------*/
+class GEM_EXTERN ocl_array : public CPPExtern
+{
+    CPPEXTERN_HEADER(ocl_array, CPPExtern);
+
+    public:
+
+        //////////
+        // Constructor
+    	ocl_array(void);
+
+      void binaryMess(t_symbol*, int, t_atom*);
+      void unaryMess(t_symbol*, int, t_atom*);
+      void saxpyMess(t_symbol*, int, t_atom*);
+      void reduceMess(t_symbol*, int, t_atom*);
+      void clearMess(void);
+
+    protected:
+
+    	//////////
+    	// Destructor
+    	virtual ~ocl_array();
+
+      t_outlet	*m_dataOut;
+
+    private:
+
+      struct deviceArray {
+        deviceArray(void) : mem(0), capacity(0) {}
+        cl_mem mem;
+        // elements the buffer can hold
+        size_t capacity;
+        // contents of the buffer, as last uploaded or downloaded
+        std::vector<float> shadow;
+      };
+
+      bool initOpenCL();
+      cl_kernel kernel(const std::string &name);
+      t_garray *findArray(t_symbol *name, t_word **vec, int *size);
+      // the device buffer of an array, brought up to date
+      cl_mem upload(t_symbol *name);
+      // copy the first n elements of the device buffer into the array
+      bool download(t_symbol *name, size_t n);
+      size_t arraySize(t_symbol *name);
+      bool enqueue(cl_kernel kernel, size_t n);
+
+      oclRuntime *m_runtime;
+      cl_program m_program;
+
+      std::map<t_symbol*, deviceArray> m_arrays;
+      oclBufferPool m_pool;
+      // partial results of the reductions
+      cl_mem m_partialMem;
+};
+
+#endif	// for header file
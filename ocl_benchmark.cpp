@@ -0,0 +1,524 @@
+////////////////////////////////////////////////////////
+//
+// GEM - Graphics Environment for Multimedia
+//
+// zmoelnig@iem.kug.ac.at
+//
+// Implementation file
+//
+//    Copyright (c) 1997-2000 Mark Danks.
+//    Copyright (c) Günther Geiger.
+//    Copyright (c) 2001-2011 IOhannes m zmölnig. forum::für::umläute. IEM. zmoelnig@iem.at
+//    For information on usage and redistribution, and for a DISCLAIMER OF ALL
+//    WARRANTIES, see the file, "GEM.LICENSE.TERMS" in this distribution.
+//
+/////////////////////////////////////////////////////////
+//
+// ocl_benchmark - headless benchmark of the ocl_texreadback pipeline
+//
+// runs the ocl_texreadback kernels on synthetic images, without Pd, Gem or
+// a GL context, for every readback mode :
+//   bytes/packed/stats/blobs/points  x  exact/pipelined
+// the GL texture is replaced by a plain CL image, everything from the
+// kernels to the host-side mask is done like in [ocl_texreadback].
+//
+// usage: ocl_benchmark [-n <frames>] [-t] [-s <width>x<height>]... [<kernel.cl>]
+//   (default: 200 frames at 1280x720, 1920x1080 and 3840x2160)
+//   -t autotunes the work-group sizes first (stored for [ocl_texreadback] too)
+// OCL_DEVICE_TYPE=cpu runs it on a CPU implementation (e.g. pocl)
+//
+/////////////////////////////////////////////////////////
+
+#include "ocl_runtime.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/time.h>
+
+// same as OCL_RING_SIZE in ocl_texreadback
+#define RING_SIZE 3
+// same as OCL_STATS_GROUP_SIZE, OCL_STATS_VALUES, OCL_BLOB_LABELS and
+// OCL_BLOB_VALUES in ocl_texreadback, and its default 'maxpoints'
+#define STATS_GROUP_SIZE 64
+#define STATS_VALUES 10
+#define BLOB_LABELS 4096
+#define BLOB_VALUES 9
+#define MAX_POINTS 1024
+// frames run before measuring
+#define WARMUP_FRAMES 10
+
+// readback modes, as the 'output' of [ocl_texreadback]
+enum benchMode { MODE_BYTES, MODE_PACKED, MODE_STATS, MODE_BLOBS, MODE_POINTS, MODES };
+static const char *s_modeNames[MODES] = { "bytes", "packed", "stats", "blobs", "points" };
+
+// the kernels of ocl_texreadback.cl the modes use
+struct benchKernels {
+  cl_kernel tex, pack, stats, statsReduce, points;
+  cl_kernel cclInit, cclMerge, cclCompress, cclArea, cclRoots, blobClear, blobAccumulate;
+};
+
+struct benchSize {
+  int width, height;
+};
+
+struct benchResult {
+  double fps;
+  double latencyMean, latencyP50, latencyP99;
+  double kernelMean;
+  size_t bytesPerFrame;
+  size_t localSize[2];
+};
+
+///
+//  Wall-clock time in ms
+//
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec * 1000. + tv.tv_usec / 1000.;
+}
+
+///
+//  Size in bytes of the result buffer, as ocl_texreadback::binBufSize()
+//
+static size_t resultSize(int mode, int width, int height)
+{
+  switch ( mode ){
+  case MODE_PACKED:
+    return sizeof(cl_uint) * ((width+31)/32) * height;
+  case MODE_STATS:
+    return sizeof(cl_ulong) * STATS_VALUES;
+  case MODE_BLOBS:
+    return sizeof(cl_uint) * (1 + BLOB_LABELS * BLOB_VALUES);
+  case MODE_POINTS:
+    return sizeof(cl_uint) * (1 + MAX_POINTS);
+  default:
+    return sizeof(cl_uchar) * width * height;
+  }
+}
+
+///
+//  Arguments of the first kernel of a mode
+//
+static cl_int setMainArgs(cl_kernel kernel, int mode, cl_mem image, cl_mem dst,
+                          int width, int height, const cl_int4 &roi)
+{
+  cl_int errNum;
+  errNum  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &image);
+  errNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &dst);
+  errNum |= clSetKernelArg(kernel, 2, sizeof(cl_int), &width);
+  errNum |= clSetKernelArg(kernel, 3, sizeof(cl_int), &height);
+  errNum |= clSetKernelArg(kernel, 4, sizeof(cl_int4), &roi);
+  if ( mode == MODE_POINTS ){
+    cl_int maxPoints = MAX_POINTS;
+    errNum |= clSetKernelArg(kernel, 5, sizeof(cl_int), &maxPoints);
+  }
+  return errNum;
+}
+
+///
+//  Label the components of the mask and measure them into 'table',
+//  as ocl_texreadback::enqueueBlobs() (minarea 1)
+//
+static cl_int enqueueBlobs(cl_command_queue queue, const benchKernels &k,
+                           cl_mem labels, cl_mem areas, cl_mem table, int width, int height,
+                           const size_t global[2], const size_t *local, cl_event *done)
+{
+  cl_int errNum = CL_SUCCESS;
+  cl_int maxLabels = BLOB_LABELS;
+  cl_int tableSize = 1 + BLOB_LABELS * BLOB_VALUES;
+  cl_int minArea = 1;
+  size_t clearSize = tableSize;
+
+  errNum |= clSetKernelArg(k.cclMerge, 0, sizeof(cl_mem), &labels);
+  errNum |= clSetKernelArg(k.cclMerge, 1, sizeof(cl_int), &width);
+  errNum |= clSetKernelArg(k.cclMerge, 2, sizeof(cl_int), &height);
+  errNum |= clEnqueueNDRangeKernel(queue, k.cclMerge, 2, NULL, global, local, 0, NULL, NULL);
+
+  errNum |= clSetKernelArg(k.cclCompress, 0, sizeof(cl_mem), &labels);
+  errNum |= clSetKernelArg(k.cclCompress, 1, sizeof(cl_mem), &areas);
+  errNum |= clSetKernelArg(k.cclCompress, 2, sizeof(cl_int), &width);
+  errNum |= clSetKernelArg(k.cclCompress, 3, sizeof(cl_int), &height);
+  errNum |= clEnqueueNDRangeKernel(queue, k.cclCompress, 2, NULL, global, local, 0, NULL, NULL);
+
+  errNum |= clSetKernelArg(k.cclArea, 0, sizeof(cl_mem), &labels);
+  errNum |= clSetKernelArg(k.cclArea, 1, sizeof(cl_mem), &areas);
+  errNum |= clSetKernelArg(k.cclArea, 2, sizeof(cl_int), &width);
+  errNum |= clSetKernelArg(k.cclArea, 3, sizeof(cl_int), &height);
+  errNum |= clEnqueueNDRangeKernel(queue, k.cclArea, 2, NULL, global, local, 0, NULL, NULL);
+
+  errNum |= clSetKernelArg(k.blobClear, 0, sizeof(cl_mem), &table);
+  errNum |= clSetKernelArg(k.blobClear, 1, sizeof(cl_int), &tableSize);
+  errNum |= clEnqueueNDRangeKernel(queue, k.blobClear, 1, NULL, &clearSize, NULL, 0, NULL, NULL);
+
+  errNum |= clSetKernelArg(k.cclRoots, 0, sizeof(cl_mem), &labels);
+  errNum |= clSetKernelArg(k.cclRoots, 1, sizeof(cl_mem), &areas);
+  errNum |= clSetKernelArg(k.cclRoots, 2, sizeof(cl_mem), &table);
+  errNum |= clSetKernelArg(k.cclRoots, 3, sizeof(cl_int), &width);
+  errNum |= clSetKernelArg(k.cclRoots, 4, sizeof(cl_int), &height);
+  errNum |= clSetKernelArg(k.cclRoots, 5, sizeof(cl_int), &minArea);
+  errNum |= clEnqueueNDRangeKernel(queue, k.cclRoots, 2, NULL, global, local, 0, NULL, NULL);
+
+  errNum |= clSetKernelArg(k.blobAccumulate, 0, sizeof(cl_mem), &labels);
+  errNum |= clSetKernelArg(k.blobAccumulate, 1, sizeof(cl_mem), &table);
+  errNum |= clSetKernelArg(k.blobAccumulate, 2, sizeof(cl_int), &width);
+  errNum |= clSetKernelArg(k.blobAccumulate, 3, sizeof(cl_int), &height);
+  errNum |= clSetKernelArg(k.blobAccumulate, 4, sizeof(cl_int), &maxLabels);
+  errNum |= clEnqueueNDRangeKernel(queue, k.blobAccumulate, 2, NULL, global, local, 0, NULL, done);
+  return errNum;
+}
+
+///
+//  Synthetic RGBA frame : a diagonal gradient with some noise,
+//  about half of the pixels end up in the mask
+//
+static cl_mem createImage(cl_context context, int width, int height)
+{
+  std::vector<unsigned char> pixels(4 * width * height);
+  unsigned int seed = 1;
+  for ( int j = 0; j < height; j++ ){
+    for ( int i = 0; i < width; i++ ){
+      seed = seed * 1103515245 + 12345;
+      int value = ( 255 * (i + j) ) / (width + height) + (int)((seed >> 16) & 63) - 32;
+      unsigned char *p = &pixels[4 * (i + width * j)];
+      p[0] = p[1] = p[2] = value < 0 ? 0 : value > 255 ? 255 : value;
+      p[3] = 255;
+    }
+  }
+
+  cl_image_format format = { CL_RGBA, CL_UNORM_INT8 };
+  cl_int errNum;
+  cl_mem image = clCreateImage2D(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, &format,
+                                 width, height, 0, &pixels[0], &errNum);
+  if ( errNum != CL_SUCCESS ){
+    std::cerr << "Error creating " << width << "x" << height << " image." << std::endl;
+    return 0;
+  }
+  return image;
+}
+
+///
+//  Run 'frames' frames through the pipeline in one readback mode
+//
+static bool runMode(oclRuntime *runtime, const benchKernels &k, cl_mem image,
+                    int width, int height, int mode, bool pipelined,
+                    int frames, bool tune, benchResult &result)
+{
+  cl_context context = runtime->context();
+  cl_command_queue queue = runtime->profilingQueue();
+  cl_int errNum;
+  bool ok = true;
+
+  size_t bufSize = resultSize(mode, width, height);
+  std::vector<unsigned char> mask(width * height);
+
+  cl_mem ring[RING_SIZE];
+  // first and last kernel of each frame (0 : the first is the only one)
+  cl_event ready[RING_SIZE], kernelDone[RING_SIZE], lastDone[RING_SIZE];
+  unsigned char *ptr[RING_SIZE];
+  double issued[RING_SIZE];
+  for ( int i = 0; i < RING_SIZE; i++ ){
+    ring[i] = clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, bufSize, NULL, NULL);
+    ready[i] = kernelDone[i] = lastDone[i] = 0;
+    ptr[i] = NULL;
+    if ( ring[i] == NULL ) ok = false;
+  }
+
+  // intermediate results : per work-group statistics, or labels and areas
+  size_t words = (width+31)/32;
+  cl_int statsGroups = (words * height + STATS_GROUP_SIZE - 1) / STATS_GROUP_SIZE;
+  cl_mem scratch[2] = { 0, 0 };
+  if ( mode == MODE_STATS ){
+    scratch[0] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_ulong) * STATS_VALUES * statsGroups, NULL, NULL);
+    if ( scratch[0] == NULL ) ok = false;
+  }
+  if ( mode == MODE_BLOBS ){
+    scratch[0] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int) * width * height, NULL, NULL);
+    scratch[1] = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * width * height, NULL, NULL);
+    if ( scratch[0] == NULL || scratch[1] == NULL ) ok = false;
+  }
+  if ( !ok ) std::cerr << "Error creating memory objects." << std::endl;
+
+  // whole frame, no decimation
+  cl_int4 roi;
+  roi.s[0] = roi.s[1] = roi.s[3] = 0;
+  roi.s[2] = 1;
+
+  // first kernel, as ocl_texreadback::outputKernel() ; stats and blobs
+  // write their intermediate results first
+  cl_kernel kernel = k.tex;
+  if ( mode == MODE_PACKED ) kernel = k.pack;
+  if ( mode == MODE_STATS ) kernel = k.stats;
+  if ( mode == MODE_BLOBS ) kernel = k.cclInit;
+  if ( mode == MODE_POINTS ) kernel = k.points;
+
+  // same domains and work-group sizes as ocl_texreadback::chooseLocalSize()
+  size_t domain[2] = { (size_t)width, (size_t)height };
+  if ( mode == MODE_PACKED ) domain[0] = words;
+  if ( mode == MODE_STATS ){
+    domain[0] = words * height;
+    domain[1] = 1;
+  }
+  size_t local[2] = { 0, 0 };
+  if ( mode == MODE_STATS ){
+    // reqd_work_group_size
+    local[0] = STATS_GROUP_SIZE;
+    local[1] = 1;
+  } else if ( tune && ok ){
+    setMainArgs(kernel, mode, image, scratch[0] ? scratch[0] : ring[0], width, height, roi);
+    runtime->tuneLocalSize(kernel, domain, local);
+  } else if ( !runtime->storedLocalSize(kernel, domain, local) && mode != MODE_PACKED ){
+    local[0] = 32;
+    local[1] = 4;
+  }
+  size_t globalWorkSize[2];
+  oclRuntime::globalSize(domain, local, globalWorkSize);
+  size_t *localWorkSize = local[0] ? local : NULL;
+  result.localSize[0] = local[0];
+  result.localSize[1] = local[1];
+
+  oclTimings latency(frames), kernelTime(frames);
+  double start = 0.;
+  int total = frames + WARMUP_FRAMES;
+
+  for ( int f = 0; f < total + (pipelined ? 1 : 0) && ok; f++ ){
+    if ( f == WARMUP_FRAMES ) start = now();
+    int slot = f % RING_SIZE;
+
+    if ( f < total ){
+      // give the buffer back to the device, as in unmapResult()
+      if ( ready[slot] ) clReleaseEvent(ready[slot]);
+      ready[slot] = 0;
+      if ( ptr[slot] ) clEnqueueUnmapMemObject(queue, ring[slot], ptr[slot], 0, NULL, NULL);
+      ptr[slot] = NULL;
+
+      errNum = setMainArgs(kernel, mode, image, scratch[0] ? scratch[0] : ring[slot], width, height, roi);
+      if ( mode == MODE_POINTS ){
+        // reset the counter only
+        cl_int counter = 1;
+        size_t one = 1;
+        errNum |= clSetKernelArg(k.blobClear, 0, sizeof(cl_mem), &ring[slot]);
+        errNum |= clSetKernelArg(k.blobClear, 1, sizeof(cl_int), &counter);
+        errNum |= clEnqueueNDRangeKernel(queue, k.blobClear, 1, NULL, &one, NULL, 0, NULL, NULL);
+      }
+
+      issued[slot] = now();
+      errNum |= clEnqueueNDRangeKernel(queue, kernel, 2, NULL, globalWorkSize, localWorkSize,
+                                       0, NULL, &kernelDone[slot]);
+      if ( mode == MODE_STATS ){
+        // second pass, by a single work-group
+        size_t reduceSize = STATS_GROUP_SIZE;
+        errNum |= clSetKernelArg(k.statsReduce, 0, sizeof(cl_mem), &scratch[0]);
+        errNum |= clSetKernelArg(k.statsReduce, 1, sizeof(cl_int), &statsGroups);
+        errNum |= clSetKernelArg(k.statsReduce, 2, sizeof(cl_mem), &ring[slot]);
+        errNum |= clEnqueueNDRangeKernel(queue, k.statsReduce, 1, NULL, &reduceSize, &reduceSize,
+                                         0, NULL, &lastDone[slot]);
+      }
+      if ( mode == MODE_BLOBS )
+        errNum |= enqueueBlobs(queue, k, scratch[0], scratch[1], ring[slot], width, height,
+                               globalWorkSize, localWorkSize, &lastDone[slot]);
+      ptr[slot] = (unsigned char*)clEnqueueMapBuffer(queue, ring[slot], CL_FALSE, CL_MAP_READ,
+                                                     0, bufSize, 0, NULL, &ready[slot], &errNum);
+      if ( errNum != CL_SUCCESS ){
+        std::cerr << "Error queuing kernel for execution." << std::endl;
+        ptr[slot] = NULL;
+        ok = false;
+        break;
+      }
+      clFlush(queue);
+    }
+
+    // pipelined : the previous frame is output while this one is in flight
+    int out = slot;
+    if ( pipelined ){
+      if ( f == 0 ) continue;
+      out = (slot + RING_SIZE - 1) % RING_SIZE;
+    }
+
+    if ( clWaitForEvents(1, &ready[out]) != CL_SUCCESS ){
+      std::cerr << "Error reading result buffer." << std::endl;
+      ok = false;
+      break;
+    }
+    if ( mode == MODE_PACKED )
+      oclUnpackMask((const cl_uint*)ptr[out], &mask[0], width, height);
+
+    // output of frame f (exact) or f-1 (pipelined)
+    int frame = pipelined ? f - 1 : f;
+    if ( frame >= WARMUP_FRAMES ){
+      latency.add(now() - issued[out]);
+      kernelTime.add(oclRuntime::eventTime(kernelDone[out], lastDone[out] ? lastDone[out] : kernelDone[out]));
+    }
+    clReleaseEvent(kernelDone[out]);
+    kernelDone[out] = 0;
+    if ( lastDone[out] ) clReleaseEvent(lastDone[out]);
+    lastDone[out] = 0;
+  }
+  double elapsed = now() - start;
+
+  clFinish(queue);
+  for ( int i = 0; i < RING_SIZE; i++ ){
+    if ( ptr[i] ) clEnqueueUnmapMemObject(queue, ring[i], ptr[i], 0, NULL, NULL);
+    if ( ready[i] ) clReleaseEvent(ready[i]);
+    if ( kernelDone[i] ) clReleaseEvent(kernelDone[i]);
+    if ( lastDone[i] ) clReleaseEvent(lastDone[i]);
+  }
+  clFinish(queue);
+  for ( int i = 0; i < RING_SIZE; i++ )
+    if ( ring[i] ) clReleaseMemObject(ring[i]);
+  for ( int i = 0; i < 2; i++ )
+    if ( scratch[i] ) clReleaseMemObject(scratch[i]);
+
+  if ( !ok ) return false;
+
+  result.fps = elapsed > 0. ? frames * 1000. / elapsed : 0.;
+  result.latencyMean = latency.mean();
+  result.latencyP50 = latency.percentile(50.);
+  result.latencyP99 = latency.percentile(99.);
+  result.kernelMean = kernelTime.mean();
+  result.bytesPerFrame = bufSize;
+  return true;
+}
+
+static void usage()
+{
+  std::cerr << "usage: ocl_benchmark [-n <frames>] [-t] [-s <width>x<height>]... [<kernel.cl>]" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+  int frames = 200;
+  bool tune = false;
+  std::vector<benchSize> sizes;
+  const char *kernelFile = "ocl_texreadback.cl";
+
+  for ( int i = 1; i < argc; i++ ){
+    std::string arg = argv[i];
+    if ( arg == "-n" && i + 1 < argc ){
+      frames = atoi(argv[++i]);
+    } else if ( arg == "-t" ){
+      tune = true;
+    } else if ( arg == "-s" && i + 1 < argc ){
+      benchSize size;
+      if ( sscanf(argv[++i], "%dx%d", &size.width, &size.height) != 2 ||
+           size.width <= 0 || size.height <= 0 ){
+        usage();
+        return 1;
+      }
+      sizes.push_back(size);
+    } else if ( arg[0] != '-' ){
+      kernelFile = argv[i];
+    } else {
+      usage();
+      return 1;
+    }
+  }
+  if ( frames <= 0 ){
+    usage();
+    return 1;
+  }
+  if ( sizes.empty() ){
+    const benchSize defaults[3] = { { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 } };
+    sizes.assign(defaults, defaults + 3);
+  }
+
+  oclRuntime *runtime = oclRuntime::acquire(false);
+  if ( runtime == NULL ){
+    std::cerr << "Failed to create OpenCL context." << std::endl;
+    return 1;
+  }
+
+  cl_program program = runtime->getProgramFromFile(kernelFile);
+  benchKernels k;
+  struct {
+    const char *name;
+    cl_kernel *kernel;
+  } kernels[] = {
+    { "process_texture_kernel", &k.tex },
+    { "pack_texture_kernel", &k.pack },
+    { "stats_texture_kernel", &k.stats },
+    { "stats_reduce_kernel", &k.statsReduce },
+    { "points_texture_kernel", &k.points },
+    { "ccl_init_kernel", &k.cclInit },
+    { "ccl_merge_kernel", &k.cclMerge },
+    { "ccl_compress_kernel", &k.cclCompress },
+    { "ccl_area_kernel", &k.cclArea },
+    { "ccl_roots_kernel", &k.cclRoots },
+    { "blob_clear_kernel", &k.blobClear },
+    { "blob_accumulate_kernel", &k.blobAccumulate },
+  };
+  bool found = ( program != NULL );
+  for ( size_t i = 0; found && i < sizeof(kernels) / sizeof(kernels[0]); i++ ){
+    *kernels[i].kernel = runtime->getKernel(program, kernels[i].name);
+    found = ( *kernels[i].kernel != NULL );
+  }
+  if ( !found ){
+    std::cerr << "Failed to create kernels from " << kernelFile << std::endl;
+    if ( program ) runtime->releaseProgram(program);
+    oclRuntime::release(runtime);
+    return 1;
+  }
+
+  std::cout << "device: " << runtime->deviceName() << ", " << frames << " frames" << std::endl;
+  std::cout << std::left << std::setw(11) << "size"
+            << std::setw(18) << "mode" << std::right
+            << std::setw(9) << "fps"
+            << std::setw(10) << "Mpix/s"
+            << std::setw(10) << "lat mean"
+            << std::setw(10) << "lat p50"
+            << std::setw(10) << "lat p99"
+            << std::setw(10) << "kernel"
+            << std::setw(13) << "bytes/frame"
+            << std::setw(10) << "local" << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+
+  int status = 0;
+  for ( size_t s = 0; s < sizes.size(); s++ ){
+    int width = sizes[s].width, height = sizes[s].height;
+    cl_mem image = createImage(runtime->context(), width, height);
+    if ( !image ){
+      status = 1;
+      continue;
+    }
+    std::ostringstream name;
+    name << width << "x" << height;
+
+    for ( int run = 0; run < 2 * MODES; run++ ){
+      int mode = run % MODES;
+      bool pipelined = run >= MODES;
+      std::string modeName = std::string(s_modeNames[mode]) + "/" + (pipelined ? "pipelined" : "exact");
+
+      benchResult r = benchResult();
+      if ( !runMode(runtime, k, image,
+                    width, height, mode, pipelined, frames, tune && !pipelined, r) ){
+        std::cerr << name.str() << " " << modeName << " failed" << std::endl;
+        status = 1;
+        continue;
+      }
+      std::cout << std::left << std::setw(11) << name.str()
+                << std::setw(18) << modeName << std::right
+                << std::setw(9) << r.fps
+                << std::setw(10) << r.fps * width * height * 1e-6
+                << std::setw(10) << r.latencyMean
+                << std::setw(10) << r.latencyP50
+                << std::setw(10) << r.latencyP99
+                << std::setw(10) << r.kernelMean
+                << std::setw(13) << r.bytesPerFrame;
+      std::ostringstream local;
+      if ( r.localSize[0] ) local << r.localSize[0] << "x" << r.localSize[1];
+      else local << "driver";
+      std::cout << std::setw(10) << local.str() << std::endl;
+    }
+    clReleaseMemObject(image);
+  }
+  std::cout << "(latencies and kernel times in ms)" << std::endl;
+
+  runtime->releaseProgram(program);
+  oclRuntime::release(runtime);
+  return status;
+}
@@ -0,0 +1,84 @@
+// example kernels for [ocl_kernel]
+
+__constant sampler_t srcSampler = CLK_NORMALIZED_COORDS_FALSE |
+        CLK_ADDRESS_CLAMP_TO_EDGE |
+        CLK_FILTER_NEAREST ;
+
+// [ocl_kernel ocl_kernel.cl gain]
+// arg src pix, arg dst pix, arg gain 1.5 1 1 1
+__kernel void gain(__read_only image2d_t src,
+                   __write_only image2d_t dst,
+                   const float4 gain)
+{
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+  if ( x >= get_image_width(src) || y >= get_image_height(src) ) return;
+
+  int2 coord = { x, y };
+  float4 color = read_imagef(src, srcSampler, coord);
+  write_imagef(dst, coord, clamp(color * gain, 0.0f, 1.0f));
+}
+
+// [ocl_kernel ocl_kernel.cl invert]
+// arg src pix, arg dst pix
+__kernel void invert(__read_only image2d_t src,
+                     __write_only image2d_t dst)
+{
+  int x = get_global_id(0);
+  int y = get_global_id(1);
+  if ( x >= get_image_width(src) || y >= get_image_height(src) ) return;
+
+  int2 coord = { x, y };
+  float4 color = read_imagef(src, srcSampler, coord);
+  write_imagef(dst, coord, (float4)(1.0f - color.x, 1.0f - color.y, 1.0f - color.z, color.w));
+}
+
+// [ocl_kernel ocl_kernel.cl rowsum]
+// arg src pix, arg sums buffer <height>, then 'read sums'
+__kernel void rowsum(__read_only image2d_t src,
+                     __global float *sums)
+{
+  int y = get_global_id(1);
+  if ( get_global_id(0) != 0 || y >= get_image_height(src) ) return;
+
+  float sum = 0.0f;
+  for ( int x = 0; x < get_image_width(src); x++ ){
+    int2 coord = { x, y };
+    sum += read_imagef(src, srcSampler, coord).x;
+  }
+  sums[y] = sum;
+}
+
+// pipeline stages : 'pipeline minimum3 luma threshold count' runs them all
+// in the single kernel 'ocl_pipeline'
+
+// reads the image : 3x3 minimum (erosion) of the source
+float4 minimum3(__read_only image2d_t src, int2 coord)
+{
+  float4 color = read_imagef(src, srcSampler, coord);
+  for ( int j = -1; j <= 1; j++ )
+    for ( int i = -1; i <= 1; i++ ){
+      int2 neighbour = { coord.x + i, coord.y + j };
+      color = min(color, read_imagef(src, srcSampler, neighbour));
+    }
+  return color;
+}
+
+float4 luma(float4 color)
+{
+  float v = 0.299f*color.x + 0.587f*color.y + 0.114f*color.z;
+  return (float4)(v, v, v, color.w);
+}
+
+// 'arg threshold_level 0.5'
+float4 threshold(float4 color, const float level)
+{
+  float v = color.x > level ? 1.0f : 0.0f;
+  return (float4)(v, v, v, 1.0f);
+}
+
+// 'arg count_pixels buffer 1', then 'read count_pixels'
+void count(float4 color, int2 coord, __global uint *pixels)
+{
+  if ( color.x > 0.5f ) atomic_inc(pixels);
+}
@@ -0,0 +1,1010 @@
+////////////////////////////////////////////////////////
+//
+// GEM - Graphics Environment for Multimedia
+//
+// zmoelnig@iem.kug.ac.at
+//
+// Implementation file
+//
+//    Copyright (c) 1997-2000 Mark Danks.
+//    Copyright (c) Günther Geiger.
+//    Copyright (c) 2001-2011 IOhannes m zmölnig. forum::für::umläute. IEM. zmoelnig@iem.at
+//    For information on usage and redistribution, and for a DISCLAIMER OF ALL
+//    WARRANTIES, see the file, "GEM.LICENSE.TERMS" in this distribution.
+//
+/////////////////////////////////////////////////////////
+
+#include "ocl_kernel.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <sstream>
+#include <algorithm>
+
+CPPEXTERN_NEW_WITH_TWO_ARGS(ocl_kernel, t_symbol*, A_DEFSYMBOL, t_symbol*, A_DEFSYMBOL);
+
+// element types of kernel arguments
+enum {
+  TYPE_CHAR, TYPE_UCHAR, TYPE_SHORT, TYPE_USHORT, TYPE_INT, TYPE_UINT,
+  TYPE_LONG, TYPE_ULONG, TYPE_FLOAT, TYPE_DOUBLE
+};
+static const struct {
+  const char *name;
+  size_t size;
+} s_types[] = {
+  { "char", 1 }, { "uchar", 1 }, { "short", 2 }, { "ushort", 2 }, { "int", 4 }, { "uint", 4 },
+  { "long", 8 }, { "ulong", 8 }, { "float", 4 }, { "double", 8 }
+};
+static const int s_numTypes = sizeof(s_types) / sizeof(s_types[0]);
+
+///
+//  "float4" : 4 floats, "int*" : ints (the pointer itself is a cl_mem).
+//  returns false for anything else (structs, half, bool...)
+//
+static bool parseType(std::string name, int &type, int &count)
+{
+  if ( !name.empty() && name[name.size()-1] == '*' ) name.erase(name.size()-1);
+  for ( type = 0; type < s_numTypes; type++ ){
+    size_t len = strlen(s_types[type].name);
+    if ( name.compare(0, len, s_types[type].name) != 0 ) continue;
+    std::string width = name.substr(len);
+    if ( width.empty() ){
+      count = 1;
+      return true;
+    }
+    if ( width.find_first_not_of("0123456789") != std::string::npos ) continue;
+    count = atoi(width.c_str());
+    // 3 component vectors take the room of 4
+    if ( count == 3 ) count = 4;
+    return count == 2 || count == 4 || count == 8 || count == 16;
+  }
+  return false;
+}
+
+static void writeScalar(unsigned char *dst, int type, double v)
+{
+  switch ( type ){
+  case TYPE_CHAR:   { cl_char   x = (cl_char)v;   memcpy(dst, &x, sizeof(x)); break; }
+  case TYPE_UCHAR:  { cl_uchar  x = (cl_uchar)v;  memcpy(dst, &x, sizeof(x)); break; }
+  case TYPE_SHORT:  { cl_short  x = (cl_short)v;  memcpy(dst, &x, sizeof(x)); break; }
+  case TYPE_USHORT: { cl_ushort x = (cl_ushort)v; memcpy(dst, &x, sizeof(x)); break; }
+  case TYPE_INT:    { cl_int    x = (cl_int)v;    memcpy(dst, &x, sizeof(x)); break; }
+  case TYPE_UINT:   { cl_uint   x = (cl_uint)v;   memcpy(dst, &x, sizeof(x)); break; }
+  case TYPE_LONG:   { cl_long   x = (cl_long)v;   memcpy(dst, &x, sizeof(x)); break; }
+  case TYPE_ULONG:  { cl_ulong  x = (cl_ulong)v;  memcpy(dst, &x, sizeof(x)); break; }
+  case TYPE_FLOAT:  { cl_float  x = (cl_float)v;  memcpy(dst, &x, sizeof(x)); break; }
+  case TYPE_DOUBLE: { cl_double x = (cl_double)v; memcpy(dst, &x, sizeof(x)); break; }
+  }
+}
+
+static double readScalar(const unsigned char *src, int type)
+{
+  switch ( type ){
+  case TYPE_CHAR:   { cl_char   x; memcpy(&x, src, sizeof(x)); return x; }
+  case TYPE_UCHAR:  { cl_uchar  x; memcpy(&x, src, sizeof(x)); return x; }
+  case TYPE_SHORT:  { cl_short  x; memcpy(&x, src, sizeof(x)); return x; }
+  case TYPE_USHORT: { cl_ushort x; memcpy(&x, src, sizeof(x)); return x; }
+  case TYPE_INT:    { cl_int    x; memcpy(&x, src, sizeof(x)); return x; }
+  case TYPE_UINT:   { cl_uint   x; memcpy(&x, src, sizeof(x)); return x; }
+  case TYPE_LONG:   { cl_long   x; memcpy(&x, src, sizeof(x)); return (double)x; }
+  case TYPE_ULONG:  { cl_ulong  x; memcpy(&x, src, sizeof(x)); return (double)x; }
+  case TYPE_FLOAT:  { cl_float  x; memcpy(&x, src, sizeof(x)); return x; }
+  case TYPE_DOUBLE: { cl_double x; memcpy(&x, src, sizeof(x)); return x; }
+  }
+  return 0;
+}
+
+///
+//  Argument names and types need OpenCL 1.2 and -cl-kernel-arg-info
+//
+static bool hasArgInfo(cl_device_id device)
+{
+#ifdef CL_VERSION_1_2
+  char version[128] = "";
+  int major = 0, minor = 0;
+  clGetDeviceInfo(device, CL_DEVICE_VERSION, sizeof(version), version, NULL);
+  if ( sscanf(version, "OpenCL %d.%d", &major, &minor) != 2 ) return false;
+  return major > 1 || ( major == 1 && minor >= 2 );
+#else
+  return false;
+#endif
+}
+
+///
+//  Find the definition of a pipeline stage in the source :
+//    float4 <name>(float4 color, ...)                        a map
+//    float4 <name>(__read_only image2d_t src, int2 coord, ...) a source
+//    void <name>(float4 color, int2 coord, ...)               a sink
+//  returns the parameters, the fixed ones included
+//
+static bool findStage(const std::string &source, const std::string &name,
+                      bool &isVoid, std::vector<std::string> &params)
+{
+  size_t pos = 0;
+  while ( (pos = source.find(name, pos)) != std::string::npos ){
+    size_t end = pos + name.size();
+    bool word = ( pos == 0 || !( isalnum(source[pos-1]) || source[pos-1] == '_' ) ) &&
+      end < source.size() && !( isalnum(source[end]) || source[end] == '_' );
+    size_t open = source.find_first_not_of(" \t\r\n", end);
+    size_t type = source.find_last_not_of(" \t\r\n", pos ? pos-1 : 0);
+    pos = end;
+    if ( !word || open == std::string::npos || source[open] != '(' || type == std::string::npos ) continue;
+
+    if ( type >= 5 && source.compare(type-5, 6, "float4") == 0 ) isVoid = false;
+    else if ( type >= 3 && source.compare(type-3, 4, "void") == 0 ) isVoid = true;
+    else continue;
+    // kernels are no stages
+    size_t qualifier = source.find_last_not_of(" \t\r\n", type >= 4 ? type-4 : 0);
+    if ( isVoid && qualifier != std::string::npos && qualifier >= 5 &&
+         source.compare(qualifier-5, 6, "kernel") == 0 ) continue;
+    size_t close = source.find(')', open);
+    if ( close == std::string::npos ) return false;
+    // a definition, not a call
+    size_t body = source.find_first_not_of(" \t\r\n", close+1);
+    if ( body == std::string::npos || source[body] != '{' ) continue;
+
+    params.clear();
+    std::string list = source.substr(open+1, close-open-1);
+    size_t start = 0;
+    while ( start <= list.size() ){
+      size_t comma = list.find(',', start);
+      if ( comma == std::string::npos ) comma = list.size();
+      std::string param = list.substr(start, comma-start);
+      size_t first = param.find_first_not_of(" \t\r\n");
+      size_t last = param.find_last_not_of(" \t\r\n");
+      if ( first != std::string::npos ) params.push_back(param.substr(first, last-first+1));
+      start = comma + 1;
+    }
+    return true;
+  }
+  return false;
+}
+
+///
+//  Generate one kernel, 'ocl_pipeline', running all the stages on every
+//  pixel : the image is read and written once, whatever the number of stages.
+//  the extra parameters of the stages become kernel arguments, named
+//  <stage>_<parameter>
+//
+static bool fusePipeline(const std::string &source, const std::vector<std::string> &stages,
+                         std::string &kernel, std::string &errorString)
+{
+  std::ostringstream params, body;
+  bool sink = false;
+  for ( size_t i = 0; i < stages.size(); i++ ){
+    const std::string &stage = stages[i];
+    bool isVoid;
+    std::vector<std::string> stageParams;
+    if ( !findStage(source, stage, isVoid, stageParams) ){
+      errorString = "no stage function '" + stage + "'";
+      return false;
+    }
+    bool isSource = !isVoid && !stageParams.empty() && stageParams[0].find("image2d_t") != std::string::npos;
+    size_t fixed = ( isVoid || isSource ) ? 2 : 1;
+    if ( stageParams.size() < fixed ){
+      errorString = "stage '" + stage + "' has the wrong signature";
+      return false;
+    }
+    if ( isSource && i != 0 ){
+      errorString = "stage '" + stage + "' reads the image : it has to come first";
+      return false;
+    }
+    if ( isVoid && i != stages.size()-1 ){
+      errorString = "stage '" + stage + "' returns nothing : it has to come last";
+      return false;
+    }
+
+    // the same stage twice : <stage>_<n>_<parameter>
+    std::string prefix = stage + "_";
+    int count = 0;
+    for ( size_t j = 0; j < i; j++ ) if ( stages[j] == stage ) count++;
+    if ( count ){
+      std::ostringstream os;
+      os << stage << "_" << count+1 << "_";
+      prefix = os.str();
+    }
+
+    std::ostringstream call;
+    if ( isSource ) call << "  color = " << stage << "(src, coord";
+    else if ( isVoid ) call << "  " << stage << "(color, coord";
+    else call << "  color = " << stage << "(color";
+    for ( size_t j = fixed; j < stageParams.size(); j++ ){
+      const std::string &param = stageParams[j];
+      // the identifier, without a trailing [...]
+      size_t end = param.size() - 1;
+      size_t bracket = param.rfind('[');
+      if ( param[end] == ']' && bracket != std::string::npos && bracket > 0 ) end = bracket - 1;
+      end = param.find_last_not_of(" \t\r\n", end);
+      size_t start = param.find_last_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", end);
+      start = ( start == std::string::npos ) ? 0 : start + 1;
+      std::string name = prefix + param.substr(start, end-start+1);
+      params << ",\n    " << param.substr(0, start) << name;
+      call << ", " << name;
+    }
+    call << ");\n";
+    if ( i == 0 && !isSource ) body << "  color = read_imagef(src, pipelineSampler, coord);\n";
+    body << call.str();
+    sink = isVoid;
+  }
+  if ( stages.empty() ){
+    errorString = "empty pipeline";
+    return false;
+  }
+  if ( !sink ) body << "  write_imagef(dst, coord, color);\n";
+
+  std::ostringstream os;
+  os << "\n// generated by [ocl_kernel] 'pipeline'\n"
+     << "__constant sampler_t pipelineSampler = CLK_NORMALIZED_COORDS_FALSE |\n"
+     << "        CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST ;\n"
+     << "__kernel void ocl_pipeline(__read_only image2d_t src"
+     << ( sink ? "" : ",\n    __write_only image2d_t dst" ) << params.str() << ")\n"
+     << "{\n"
+     << "  int2 coord = { (int)get_global_id(0), (int)get_global_id(1) };\n"
+     << "  if ( coord.x >= get_image_width(src) || coord.y >= get_image_height(src) ) return;\n"
+     << "  float4 color;\n"
+     << body.str()
+     << "}\n";
+  kernel = os.str();
+  return true;
+}
+
+/////////////////////////////////////////////////////////
+//
+// ocl_kernel
+//
+/////////////////////////////////////////////////////////
+// Constructor
+//
+/////////////////////////////////////////////////////////
+ocl_kernel :: ocl_kernel(t_symbol *file, t_symbol *name)
+        : GemShape(),
+        m_runtime(NULL),
+        m_build(NULL),
+        m_program(0),
+        m_kernel(0)
+{
+  if ( file && *file->s_name ) m_fileName = findFile(file->s_name);
+  if ( name && *name->s_name ) m_kernelName = name->s_name;
+  m_global[0] = m_global[1] = 0;
+  m_local[0] = m_local[1] = 0;
+
+  m_infoOut = outlet_new(this->x_obj, 0);
+  m_dataOut = outlet_new(this->x_obj, 0);
+}
+
+/////////////////////////////////////////////////////////
+// Destructor
+//
+/////////////////////////////////////////////////////////
+ocl_kernel :: ~ocl_kernel()
+{
+  Cleanup();
+}
+
+///
+//  Give everything back to the runtime. The bindings of the arguments are
+//  kept, their memory objects are created again on the next render
+//
+void ocl_kernel :: Cleanup()
+{
+  for ( size_t i = 0; i < m_args.size(); i++ )
+    releaseMem(m_args[i]);
+
+  if ( m_build ){
+    m_runtime->cancelBuild(m_build);
+    m_build = NULL;
+  }
+  if ( m_kernel ){
+    clReleaseKernel(m_kernel);
+    m_kernel = 0;
+  }
+  if ( m_program ){
+    m_runtime->releaseProgram(m_program);
+    m_program = 0;
+  }
+  if ( m_runtime ){
+    oclRuntime::release(m_runtime);
+    m_runtime = NULL;
+  }
+}
+
+void ocl_kernel :: stopRendering(void)
+{
+  // GL textures belong to this context
+  Cleanup();
+}
+
+bool ocl_kernel :: initOpenCL()
+{
+  // share the context of the current GL context : textures can be bound
+  m_runtime = oclRuntime::acquire(true);
+  if ( m_runtime == NULL ){
+    error("Failed to create OpenCL context.");
+    return false;
+  }
+  return startBuild();
+}
+
+///
+// Start building the program on the runtime's worker thread
+bool ocl_kernel :: startBuild()
+{
+  if ( m_fileName.empty() ){
+    error("no kernel file, use 'open <file.cl>'");
+    return false;
+  }
+  std::string source;
+  if ( !oclRuntime::readFile(m_fileName.c_str(), source) ){
+    error("Failed to read %s", m_fileName.c_str());
+    return false;
+  }
+  if ( !m_pipeline.empty() ){
+    // the generated source is the cache key : each pipeline is built once
+    std::string kernel, errorString;
+    if ( !fusePipeline(source, m_pipeline, kernel, errorString) ){
+      error("pipeline : %s", errorString.c_str());
+      return false;
+    }
+    source += kernel;
+  }
+  if ( m_build ) m_runtime->cancelBuild(m_build);
+  m_build = m_runtime->getProgramAsync(source, hasArgInfo(m_runtime->device()) ? "-cl-kernel-arg-info" : "");
+  return true;
+}
+
+///
+// Switch to the program once its build is complete
+void ocl_kernel :: pollBuild()
+{
+  cl_program newProgram;
+  if ( m_build ){
+    if ( !m_runtime->pollProgram(m_build, &newProgram) ) return;
+    m_build = NULL;
+    if ( newProgram == NULL ){
+      error("Failed to create program%s", m_program ? ", keeping the previous one" : "");
+      return;
+    }
+    if ( m_kernel ){
+      clReleaseKernel(m_kernel);
+      m_kernel = 0;
+    }
+    if ( m_program ) m_runtime->releaseProgram(m_program);
+    m_program = newProgram;
+  }
+
+  if ( m_kernel || !m_program ) return;
+  if ( m_kernelName.empty() ){
+    error("no kernel name, use 'kernel <name>'");
+    return;
+  }
+  cl_int errNum;
+  m_kernel = clCreateKernel(m_program, m_kernelName.c_str(), &errNum);
+  if ( errNum != CL_SUCCESS ){
+    m_kernel = 0;
+    error("no kernel '%s' in %s", m_kernelName.c_str(), m_fileName.c_str());
+    return;
+  }
+  if ( !introspect() ) post("no argument info (OpenCL 1.2 needed) : bind the arguments by index");
+}
+
+///
+// Read the arguments of the new kernel. Arguments of the previous one
+// with the same name and type keep their binding, or without argument
+// info the ones with the same index
+bool ocl_kernel :: introspect()
+{
+  cl_uint numArgs = 0;
+  clGetKernelInfo(m_kernel, CL_KERNEL_NUM_ARGS, sizeof(numArgs), &numArgs, NULL);
+
+  bool info = true;
+  std::vector<kernelArg> args(numArgs);
+  for ( cl_uint i = 0; i < numArgs; i++ ){
+    kernelArg &arg = args[i];
+    arg.address = 0;
+    arg.access = 0;
+    arg.image = false;
+    arg.elementType = -1;
+    arg.elementSize = 0;
+    arg.elementCount = 0;
+    arg.kind = ARG_UNSET;
+    arg.localSize = 0;
+    arg.mem = 0;
+    arg.bufferSize = 0;
+    arg.width = arg.height = 0;
+    arg.format = 0;
+    arg.texId = 0;
+    arg.texTarget = 0;
+    arg.dirty = true;
+
+    // bound by index without argument info
+    std::ostringstream index;
+    index << i;
+    arg.name = index.str();
+
+#ifdef CL_VERSION_1_2
+    char name[256] = "", type[256] = "";
+    if ( info && clGetKernelArgInfo(m_kernel, i, CL_KERNEL_ARG_NAME, sizeof(name), name, NULL) != CL_SUCCESS )
+      info = false;
+    if ( info ){
+      clGetKernelArgInfo(m_kernel, i, CL_KERNEL_ARG_TYPE_NAME, sizeof(type), type, NULL);
+      clGetKernelArgInfo(m_kernel, i, CL_KERNEL_ARG_ADDRESS_QUALIFIER, sizeof(arg.address), &arg.address, NULL);
+      clGetKernelArgInfo(m_kernel, i, CL_KERNEL_ARG_ACCESS_QUALIFIER, sizeof(arg.access), &arg.access, NULL);
+      arg.name = name;
+      arg.typeName = type;
+      arg.image = arg.typeName.compare(0, 5, "image") == 0;
+      if ( parseType(arg.typeName, arg.elementType, arg.elementCount) )
+        arg.elementSize = s_types[arg.elementType].size;
+    }
+#else
+    info = false;
+#endif
+
+    if ( !info && i < m_args.size() ){
+      // no names : the binding of the same index goes along
+      args[i] = m_args[i];
+      args[i].dirty = true;
+      m_args[i].mem = 0;
+      m_args[i].kind = ARG_UNSET;
+      continue;
+    }
+    for ( size_t j = 0; info && j < m_args.size(); j++ ){
+      kernelArg &old = m_args[j];
+      if ( old.name != arg.name || old.typeName != arg.typeName || old.address != arg.address )
+        continue;
+      // the memory object goes along, clSetKernelArg() is due anyway
+      args[i] = old;
+      args[i].dirty = true;
+      old.mem = 0;
+      old.kind = ARG_UNSET;
+      break;
+    }
+  }
+  for ( size_t j = 0; j < m_args.size(); j++ )
+    releaseMem(m_args[j]);
+  m_args = args;
+
+  std::vector<std::vector<t_atom> > pending;
+  pending.swap(m_pending);
+  for ( size_t j = 0; j < pending.size(); j++ )
+    argMess(gensym("arg"), pending[j].size(), &pending[j][0]);
+  return info;
+}
+
+void ocl_kernel :: releaseMem(kernelArg &arg)
+{
+  if ( arg.mem ){
+    clReleaseMemObject(arg.mem);
+    arg.mem = 0;
+    arg.dirty = true;
+  }
+}
+
+ocl_kernel::kernelArg *ocl_kernel :: findArg(const t_atom *atom)
+{
+  if ( atom->a_type == A_FLOAT ){
+    int index = atom_getint(atom);
+    if ( index >= 0 && index < (int)m_args.size() ) return &m_args[index];
+    error("no argument #%d", index);
+    return NULL;
+  }
+  t_symbol *name = atom_getsymbol(atom);
+  for ( size_t i = 0; i < m_args.size(); i++ )
+    if ( m_args[i].name == name->s_name ) return &m_args[i];
+  error("no argument '%s'", name->s_name);
+  return NULL;
+}
+
+///
+// Arguments without type info take the type of their binding
+void ocl_kernel :: assumeType(kernelArg &arg, int type, int count, cl_uint address)
+{
+  if ( arg.elementType == type && arg.elementCount == count && arg.address == address ) return;
+  releaseMem(arg);
+  arg.kind = ARG_UNSET;
+  arg.image = false;
+  arg.elementType = type;
+  arg.elementSize = s_types[type].size;
+  arg.elementCount = count;
+  arg.address = address;
+}
+
+///
+// A value argument : only marked dirty if it has changed
+bool ocl_kernel :: setValue(kernelArg &arg, int argc, t_atom *argv)
+{
+  if ( arg.elementType < 0 || arg.image || arg.address != CL_KERNEL_ARG_ADDRESS_PRIVATE ){
+    error("argument '%s' (%s) does not take numbers", arg.name.c_str(), arg.typeName.c_str());
+    return false;
+  }
+  if ( argc > arg.elementCount ){
+    error("argument '%s' (%s) takes %d values", arg.name.c_str(), arg.typeName.c_str(), arg.elementCount);
+    return false;
+  }
+  // missing components are 0
+  std::vector<unsigned char> value(arg.elementSize * arg.elementCount, 0);
+  for ( int i = 0; i < argc; i++ )
+    writeScalar(&value[i * arg.elementSize], arg.elementType, atom_getfloat(argv+i));
+
+  if ( arg.kind != ARG_VALUE || value != arg.value ){
+    arg.value = value;
+    arg.kind = ARG_VALUE;
+    arg.dirty = true;
+  }
+  return true;
+}
+
+///
+// The contents of a buffer argument, from a list or 'zeros' elements.
+// kept on the host as well, to create the buffer again in a new context
+bool ocl_kernel :: setBuffer(kernelArg &arg, int argc, t_atom *argv, size_t zeros)
+{
+  if ( arg.elementType < 0 ||
+       ( arg.address != CL_KERNEL_ARG_ADDRESS_GLOBAL && arg.address != CL_KERNEL_ARG_ADDRESS_CONSTANT ) ){
+    error("argument '%s' (%s) is not a buffer", arg.name.c_str(), arg.typeName.c_str());
+    return false;
+  }
+  // whole elements : a float4* gets a multiple of 4 values
+  size_t scalars = argc ? argc : zeros * arg.elementCount;
+  size_t elements = (scalars + arg.elementCount - 1) / arg.elementCount;
+  if ( elements == 0 ){
+    error("argument '%s' : empty buffer", arg.name.c_str());
+    return false;
+  }
+  std::vector<unsigned char> value(elements * arg.elementCount * arg.elementSize, 0);
+  for ( int i = 0; i < argc; i++ )
+    writeScalar(&value[i * arg.elementSize], arg.elementType, atom_getfloat(argv+i));
+
+  if ( arg.kind == ARG_BUFFER && arg.mem && arg.bufferSize == value.size() ){
+    // same size : new contents, same argument
+    cl_int errNum = clEnqueueWriteBuffer(m_runtime->queue(), arg.mem, CL_TRUE, 0, value.size(), &value[0], 0, NULL, NULL);
+    if ( errNum != CL_SUCCESS ){
+      error("Error writing buffer.");
+      return false;
+    }
+  } else {
+    // created on the next render
+    releaseMem(arg);
+    arg.bufferSize = value.size();
+  }
+  arg.value = value;
+  arg.kind = ARG_BUFFER;
+  return true;
+}
+
+///
+// Image of the incoming pix, or of the outgoing one for write only images
+bool ocl_kernel :: preparePix(kernelArg &arg, const imageStruct *image, bool newImage)
+{
+  cl_image_format format;
+  format.image_channel_data_type = CL_UNORM_INT8;
+  switch ( image->format ){
+  case GL_RGBA:      format.image_channel_order = CL_RGBA; break;
+  case GL_BGRA_EXT:  format.image_channel_order = CL_BGRA; break;
+  case GL_LUMINANCE: format.image_channel_order = CL_R; break;
+  default:
+    error("argument '%s' : only RGBA and grey pix are supported", arg.name.c_str());
+    return false;
+  }
+  bool output = ( arg.access == CL_KERNEL_ARG_ACCESS_WRITE_ONLY );
+
+  if ( arg.mem && ( arg.width != image->xsize || arg.height != image->ysize || arg.format != image->format ) )
+    releaseMem(arg);
+  if ( !arg.mem ){
+    cl_int errNum;
+    arg.mem = clCreateImage2D(m_runtime->context(), output ? CL_MEM_WRITE_ONLY : CL_MEM_READ_ONLY,
+                              &format, image->xsize, image->ysize, 0, NULL, &errNum);
+    if ( errNum != CL_SUCCESS ){
+      arg.mem = 0;
+      error("argument '%s' : Error creating image.", arg.name.c_str());
+      return false;
+    }
+    arg.width = image->xsize;
+    arg.height = image->ysize;
+    arg.format = image->format;
+    arg.dirty = true;
+    newImage = true;
+  }
+  if ( output || !newImage ) return true;
+
+  size_t origin[3] = { 0, 0, 0 };
+  size_t region[3] = { (size_t)arg.width, (size_t)arg.height, 1 };
+  cl_int errNum = clEnqueueWriteImage(m_runtime->queue(), arg.mem, CL_TRUE, origin, region,
+                                      0, 0, image->data, 0, NULL, NULL);
+  if ( errNum != CL_SUCCESS ){
+    error("argument '%s' : Error writing image.", arg.name.c_str());
+    return false;
+  }
+  return true;
+}
+
+///
+// Share a GL texture with OpenCL, with the access of the argument
+bool ocl_kernel :: prepareTexture(kernelArg &arg)
+{
+  if ( arg.mem ) return true;
+  cl_mem_flags flags = CL_MEM_READ_WRITE;
+  if ( arg.access == CL_KERNEL_ARG_ACCESS_READ_ONLY ) flags = CL_MEM_READ_ONLY;
+  if ( arg.access == CL_KERNEL_ARG_ACCESS_WRITE_ONLY ) flags = CL_MEM_WRITE_ONLY;
+  cl_int errNum;
+  arg.mem = clCreateFromGLTexture2D(m_runtime->context(), flags, arg.texTarget, 0, arg.texId, &errNum);
+  if ( errNum != CL_SUCCESS ){
+    arg.mem = 0;
+    error("argument '%s' : Failed creating memory from GL texture %d.", arg.name.c_str(), arg.texId);
+    return false;
+  }
+  arg.dirty = true;
+  return true;
+}
+
+///
+// clSetKernelArg() for the arguments that changed since the last launch
+bool ocl_kernel :: setArgs()
+{
+  for ( size_t i = 0; i < m_args.size(); i++ ){
+    kernelArg &arg = m_args[i];
+    if ( arg.kind == ARG_UNSET ){
+      error("argument #%d '%s' is not set", (int)i, arg.name.c_str());
+      return false;
+    }
+    if ( !arg.dirty ) continue;
+
+    cl_int errNum;
+    switch ( arg.kind ){
+    case ARG_VALUE:
+      errNum = clSetKernelArg(m_kernel, i, arg.value.size(), &arg.value[0]);
+      break;
+    case ARG_LOCAL:
+      errNum = clSetKernelArg(m_kernel, i, arg.localSize, NULL);
+      break;
+    default:
+      errNum = clSetKernelArg(m_kernel, i, sizeof(cl_mem), &arg.mem);
+    }
+    if ( errNum != CL_SUCCESS ){
+      error("Error setting argument #%d '%s' (%d)", (int)i, arg.name.c_str(), errNum);
+      return false;
+    }
+    arg.dirty = false;
+  }
+  return true;
+}
+
+///
+// Read a write only image back into the outgoing pix
+void ocl_kernel :: outputPix(GemState *state, kernelArg &arg, const imageStruct &source)
+{
+  imageStruct &image = m_pixBlock.image;
+  image.xsize = arg.width;
+  image.ysize = arg.height;
+  image.setCsizeByFormat(arg.format);
+  // same orientation as the incoming pix. the pixels are our own copy
+  image.upsidedown = source.upsidedown;
+  image.reallocate();
+
+  size_t origin[3] = { 0, 0, 0 };
+  size_t region[3] = { (size_t)arg.width, (size_t)arg.height, 1 };
+  cl_int errNum = clEnqueueReadImage(m_runtime->queue(), arg.mem, CL_TRUE, origin, region,
+                                     0, 0, image.data, 0, NULL, NULL);
+  if ( errNum != CL_SUCCESS ){
+    error("argument '%s' : Error reading image.", arg.name.c_str());
+    return;
+  }
+  m_pixBlock.newimage = true;
+  state->set(GemState::_PIX, &m_pixBlock);
+}
+
+/////////////////////////////////////////////////////////
+// renderShape
+//
+/////////////////////////////////////////////////////////
+void ocl_kernel :: renderShape(GemState *state)
+{
+  if ( !m_runtime && !initOpenCL() ) return;
+  pollBuild();
+  if ( !m_kernel ) return;
+
+  pixBlock *pix = NULL;
+  state->get(GemState::_PIX, pix);
+
+  size_t global[2] = { m_global[0], m_global[1] };
+  std::vector<cl_mem> glObjects;
+  kernelArg *output = NULL;
+  for ( size_t i = 0; i < m_args.size(); i++ ){
+    kernelArg &arg = m_args[i];
+    switch ( arg.kind ){
+    case ARG_PIX:
+      if ( !pix ){
+        error("argument '%s' is bound to the pix, but there is none", arg.name.c_str());
+        return;
+      }
+      if ( !preparePix(arg, &pix->image, pix->newimage) ) return;
+      if ( arg.access == CL_KERNEL_ARG_ACCESS_WRITE_ONLY ) output = &arg;
+      break;
+    case ARG_TEXTURE:
+      if ( !prepareTexture(arg) ) return;
+      glObjects.push_back(arg.mem);
+      break;
+    case ARG_BUFFER:
+      if ( !arg.mem ){
+        cl_int errNum;
+        arg.mem = clCreateBuffer(m_runtime->context(), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                 arg.value.size(), &arg.value[0], &errNum);
+        if ( errNum != CL_SUCCESS ){
+          arg.mem = 0;
+          error("argument '%s' : Error creating buffer.", arg.name.c_str());
+          return;
+        }
+        arg.dirty = true;
+      }
+      continue;
+    default:
+      continue;
+    }
+    // the first image sets the size
+    if ( !global[0] ){
+      global[0] = arg.width;
+      global[1] = arg.height;
+    }
+  }
+  if ( !global[0] ){
+    error("no global size : bind an image to the pix or a texture, or use 'global'");
+    return;
+  }
+  if ( !global[1] ) global[1] = 1;
+  if ( !setArgs() ) return;
+
+  cl_command_queue queue = m_runtime->queue();
+  cl_int errNum;
+  if ( !glObjects.empty() ){
+    glFinish();
+    errNum = clEnqueueAcquireGLObjects(queue, glObjects.size(), &glObjects[0], 0, NULL, NULL);
+    if ( errNum != CL_SUCCESS ){
+      error("Error acquiring GL textures.");
+      return;
+    }
+  }
+
+  // not padded to the local size : any kernel may run here, not only ones
+  // that check get_global_id() against the size of the image
+  errNum = clEnqueueNDRangeKernel(queue, m_kernel, 2, NULL, global, m_local[0] ? m_local : NULL, 0, NULL, NULL);
+  if ( errNum == CL_INVALID_WORK_GROUP_SIZE && m_local[0] )
+    error("global size %dx%d is not a multiple of the local size %dx%d",
+          (int)global[0], (int)global[1], (int)m_local[0], (int)m_local[1]);
+  else if ( errNum != CL_SUCCESS )
+    error("Error queuing kernel for execution (%d).", errNum);
+
+  if ( !glObjects.empty() ){
+    clEnqueueReleaseGLObjects(queue, glObjects.size(), &glObjects[0], 0, NULL, NULL);
+    // GL uses the textures right after us
+    clFinish(queue);
+  }
+  // write only images are bound to the pix : there is one
+  if ( output ) outputPix(state, *output, pix->image);
+}
+
+/////////////////////////////////////////////////////////
+// static member function
+//
+/////////////////////////////////////////////////////////
+void ocl_kernel :: obj_setupCallback(t_class *classPtr){
+  CPPEXTERN_MSG1(classPtr, "open", openMess, t_symbol*);
+  CPPEXTERN_MSG1(classPtr, "kernel", kernelMess, t_symbol*);
+  CPPEXTERN_MSG (classPtr, "arg", argMess);
+  CPPEXTERN_MSG (classPtr, "read", readMess);
+  CPPEXTERN_MSG0(classPtr, "args", argsMess);
+  CPPEXTERN_MSG (classPtr, "global", globalMess);
+  CPPEXTERN_MSG (classPtr, "local", localMess);
+  CPPEXTERN_MSG0(classPtr, "reload", reloadMess);
+  CPPEXTERN_MSG (classPtr, "pipeline", pipelineMess);
+}
+
+void ocl_kernel :: openMess(t_symbol*s)
+{
+  m_fileName = findFile(s->s_name);
+  reloadMess();
+}
+
+void ocl_kernel :: kernelMess(t_symbol*s)
+{
+  m_kernelName = s->s_name;
+  // another kernel of the same program : no build
+  if ( m_kernel ){
+    clReleaseKernel(m_kernel);
+    m_kernel = 0;
+  }
+}
+
+void ocl_kernel :: reloadMess(void)
+{
+  // without a context, the next render will read the file anyway
+  if ( m_runtime ) startBuild();
+}
+
+void ocl_kernel :: pipelineMess(t_symbol*s, int argc, t_atom*argv)
+{
+  m_pipeline.clear();
+  for ( int i = 0; i < argc; i++ ){
+    if ( argv[i].a_type != A_SYMBOL ){
+      error("arguments: <stage> <stage>...");
+      m_pipeline.clear();
+      return;
+    }
+    m_pipeline.push_back(atom_getsymbol(argv+i)->s_name);
+  }
+  // no stages : back to the kernels of the file
+  m_kernelName = m_pipeline.empty() ? std::string("") : std::string("ocl_pipeline");
+  reloadMess();
+}
+
+void ocl_kernel :: argMess(t_symbol*s, int argc, t_atom*argv)
+{
+  if ( argc < 2 ){
+    error("arguments: <name|index> <values...>|buffer <n>|local <bytes>|pix|texture <texId> <width> <height> [<type>]");
+    return;
+  }
+  if ( !m_kernel || m_build ){
+    // bound as soon as the arguments of the new kernel are known
+    m_pending.push_back(std::vector<t_atom>(argv, argv+argc));
+    return;
+  }
+  kernelArg *arg = findArg(argv);
+  if ( !arg ) return;
+  argc--;
+  argv++;
+  // no argument info : the binding tells the type
+  bool untyped = arg->typeName.empty();
+  int type, count;
+
+  if ( untyped && argv[0].a_type == A_FLOAT ){
+    // floats by value, a float3 takes the room of a float4
+    assumeType(*arg, TYPE_FLOAT, argc == 3 ? 4 : argc, CL_KERNEL_ARG_ADDRESS_PRIVATE);
+    setValue(*arg, argc, argv);
+    return;
+  }
+  std::string typeName = atom_getsymbol(argv)->s_name;
+  if ( untyped && parseType(typeName, type, count) ){
+    if ( argc < 2 ){
+      error("arguments: <index> <type> <values...>");
+      return;
+    }
+    // "float*" : the contents of a buffer
+    if ( typeName[typeName.size()-1] == '*' ){
+      assumeType(*arg, type, count, CL_KERNEL_ARG_ADDRESS_GLOBAL);
+      setBuffer(*arg, argc-1, argv+1, 0);
+    } else {
+      assumeType(*arg, type, count, CL_KERNEL_ARG_ADDRESS_PRIVATE);
+      setValue(*arg, argc-1, argv+1);
+    }
+    return;
+  }
+
+  if ( argv[0].a_type == A_FLOAT ){
+    if ( arg->address == CL_KERNEL_ARG_ADDRESS_GLOBAL || arg->address == CL_KERNEL_ARG_ADDRESS_CONSTANT )
+      setBuffer(*arg, argc, argv, 0);
+    else
+      setValue(*arg, argc, argv);
+    return;
+  }
+
+  t_symbol *how = atom_getsymbol(argv);
+  if ( how == gensym("buffer") ){
+    if ( argc < 2 || atom_getint(argv+1) < 1 ){
+      error("arguments: <name|index> buffer <n> [<type>]");
+      return;
+    }
+    if ( untyped ){
+      type = TYPE_FLOAT;
+      count = 1;
+      if ( argc > 2 && !parseType(atom_getsymbol(argv+2)->s_name, type, count) ){
+        error("argument '%s' : unknown type '%s'", arg->name.c_str(), atom_getsymbol(argv+2)->s_name);
+        return;
+      }
+      assumeType(*arg, type, count, CL_KERNEL_ARG_ADDRESS_GLOBAL);
+    }
+    setBuffer(*arg, 0, NULL, atom_getint(argv+1));
+  } else if ( how == gensym("local") ){
+    if ( untyped ){
+      releaseMem(*arg);
+      arg->image = false;
+      arg->address = CL_KERNEL_ARG_ADDRESS_LOCAL;
+    }
+    if ( arg->address != CL_KERNEL_ARG_ADDRESS_LOCAL || argc < 2 || atom_getint(argv+1) < 1 ){
+      error("argument '%s' : 'local <bytes>' is for __local pointers", arg->name.c_str());
+      return;
+    }
+    arg->localSize = atom_getint(argv+1);
+    arg->kind = ARG_LOCAL;
+    arg->dirty = true;
+  } else if ( how == gensym("pix") ){
+    if ( untyped ){
+      bool output = argc > 1 && atom_getsymbol(argv+1) == gensym("out");
+      arg->image = true;
+      arg->elementType = -1;
+      arg->address = CL_KERNEL_ARG_ADDRESS_GLOBAL;
+      arg->access = output ? CL_KERNEL_ARG_ACCESS_WRITE_ONLY : CL_KERNEL_ARG_ACCESS_READ_ONLY;
+    }
+    if ( !arg->image ){
+      error("argument '%s' is not an image", arg->name.c_str());
+      return;
+    }
+    releaseMem(*arg);
+    arg->kind = ARG_PIX;
+  } else if ( how == gensym("texture") ){
+    if ( untyped ){
+      arg->image = true;
+      arg->elementType = -1;
+      arg->address = CL_KERNEL_ARG_ADDRESS_GLOBAL;
+    }
+    if ( !arg->image || argc < 4 ){
+      error("argument '%s' : 'texture <texId> <width> <height> [<type>]' is for images", arg->name.c_str());
+      return;
+    }
+    releaseMem(*arg);
+    arg->texId = atom_getint(argv+1);
+    arg->width = atom_getint(argv+2);
+    arg->height = atom_getint(argv+3);
+    arg->texTarget = argc > 4 ? atom_getint(argv+4) : GL_TEXTURE_2D;
+    arg->kind = ARG_TEXTURE;
+  } else {
+    error("unknown binding '%s'", how->s_name);
+  }
+}
+
+void ocl_kernel :: readMess(t_symbol*s, int argc, t_atom*argv)
+{
+  if ( argc != 1 ){
+    error("arguments: <name|index>");
+    return;
+  }
+  kernelArg *arg = m_kernel ? findArg(argv) : NULL;
+  if ( !arg ) return;
+  if ( arg->kind != ARG_BUFFER || !arg->mem ){
+    error("argument '%s' is not a buffer in use", arg->name.c_str());
+    return;
+  }
+  std::vector<unsigned char> data(arg->bufferSize);
+  cl_int errNum = clEnqueueReadBuffer(m_runtime->queue(), arg->mem, CL_TRUE, 0, data.size(), &data[0], 0, NULL, NULL);
+  if ( errNum != CL_SUCCESS ){
+    error("Error reading buffer.");
+    return;
+  }
+  size_t count = data.size() / arg->elementSize;
+  std::vector<t_atom> atoms(count);
+  for ( size_t i = 0; i < count; i++ )
+    SETFLOAT(&atoms[i], readScalar(&data[i * arg->elementSize], arg->elementType));
+  outlet_anything(m_dataOut, gensym(arg->name.c_str()), count, &atoms[0]);
+}
+
+void ocl_kernel :: argsMess(void)
+{
+  for ( size_t i = 0; i < m_args.size(); i++ ){
+    const kernelArg &arg = m_args[i];
+    const char *qualifier = "private";
+    if ( arg.address == CL_KERNEL_ARG_ADDRESS_GLOBAL ) qualifier = "global";
+    if ( arg.address == CL_KERNEL_ARG_ADDRESS_CONSTANT ) qualifier = "constant";
+    if ( arg.address == CL_KERNEL_ARG_ADDRESS_LOCAL ) qualifier = "local";
+    if ( arg.image ) qualifier = arg.access == CL_KERNEL_ARG_ACCESS_WRITE_ONLY ? "write_only" : "read_only";
+    t_atom ap[4];
+    SETFLOAT (ap+0, i);
+    SETSYMBOL(ap+1, gensym(arg.name.c_str()));
+    SETSYMBOL(ap+2, gensym(arg.typeName.c_str()));
+    SETSYMBOL(ap+3, gensym(qualifier));
+    outlet_anything(m_infoOut, gensym("arg"), 4, ap);
+  }
+}
+
+void ocl_kernel :: globalMess(t_symbol*s, int argc, t_atom*argv)
+{
+  // no arguments : back to the size of the pix
+  m_global[0] = argc > 0 ? std::max(0, (int)atom_getint(argv+0)) : 0;
+  m_global[1] = argc > 1 ? std::max(0, (int)atom_getint(argv+1)) : 0;
+}
+
+void ocl_kernel :: localMess(t_symbol*s, int argc, t_atom*argv)
+{
+  // no arguments : the driver chooses
+  m_local[0] = argc > 0 ? std::max(0, (int)atom_getint(argv+0)) : 0;
+  m_local[1] = argc > 1 ? std::max(1, (int)atom_getint(argv+1)) : 1;
+  if ( !m_local[0] ) m_local[1] = 0;
+}
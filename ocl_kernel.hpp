@@ -0,0 +1,187 @@
+/*-----------------------------------------------------------------
+LOG
+    GEM - Graphics Environment for Multimedia
+
+    ocl_kernel - run any OpenCL kernel on a pix or a texture
+
+    Copyright (c) 1997-2000 Mark Danks. mark@danks.org
+    Copyright (c) Günther Geiger. geiger@epy.co.at
+    Copyright (c) 2001-2011 IOhannes m zmölnig. forum::für::umläute. IEM. zmoelnig@iem.at
+    For information on usage and redistribution, and for a DISCLAIMER OF ALL
+    WARRANTIES, see the file, "GEM.LICENSE.TERMS" in this distribution.
+
+-----------------------------------------------------------------*/
+
+#ifndef _INCLUDE__GEM_OCL_KERNEL_H_
+#define _INCLUDE__GEM_OCL_KERNEL_H_
+
+#include "Base/GemShape.h"
+#include "Gem/State.h"
+#include "Gem/Exception.h"
+#include "Gem/Image.h"
+
+#include "ocl_runtime.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+
+/*-----------------------------------------------------------------
+-------------------------------------------------------------------
+CLASS
+    ocl_kernel
+
+    run a kernel of any .cl file
+
+KEYWORDS
+    pix
+
+DESCRIPTION
+
+    [ocl_kernel <file.cl> <kernel>]
+
+    the arguments of the kernel are introspected (OpenCL 1.2) and bound
+    by name or index with 'arg <name|index> ...' :
+      <numbers> : a scalar or vector value, or the contents of the
+                  buffer behind a __global or __constant pointer
+      buffer <n> : a buffer of n zeroed elements, see 'read'
+      local <bytes> : __local memory
+      pix : the incoming pix (read only image) or the outgoing one
+            (write only image)
+      texture <texId> <width> <height> [<type>] : a GL texture, in the
+            format [pix_texture] sends out
+    without argument info the binding tells the type :
+      <numbers> : floats, by value
+      <type> <numbers> : e.g. 'int 3' or 'float4 1 0 0 1' by value,
+                  'float* 1 2 3' as the contents of a buffer
+      buffer <n> [<type>] : n zeroed elements, float by default
+      pix [in|out] : read only image (default) or write only image
+    clSetKernelArg() is only called for the arguments that changed.
+    the global size is the size of the pix unless set with 'global'.
+    it is not padded to the work-group size set with 'local' : a size that
+    is not a multiple of it is an error on OpenCL 1.x
+
+    'pipeline <stage>...' fuses per-pixel functions of the file into one
+    kernel, 'ocl_pipeline' : the image is read and written once for all
+    the stages. a stage is
+      float4 <stage>(float4 color, ...) : maps the color
+      float4 <stage>(__read_only image2d_t src, int2 coord, ...) : reads
+          the neighbourhood, first stage only
+      void <stage>(float4 color, int2 coord, ...) : consumes the color
+          (e.g. into a buffer), last stage only : no image is written
+    their other parameters are kernel arguments named <stage>_<parameter>
+
+-----------------------------------------------------------------*/
+class GEM_EXTERN ocl_kernel : public GemShape
+{
+    CPPEXTERN_HEADER(ocl_kernel, GemShape);
+
+    public:
+
+        //////////
+        // Constructor
+    	ocl_kernel(t_symbol *file, t_symbol *name);
+
+      void openMess(t_symbol*);
+      void kernelMess(t_symbol*);
+      void argMess(t_symbol*, int, t_atom*);
+      void readMess(t_symbol*, int, t_atom*);
+      void argsMess(void);
+      void globalMess(t_symbol*, int, t_atom*);
+      void localMess(t_symbol*, int, t_atom*);
+      void reloadMess(void);
+      void pipelineMess(t_symbol*, int, t_atom*);
+
+    protected:
+
+    	//////////
+    	// Destructor
+    	virtual ~ocl_kernel();
+
+    	//////////
+    	// Do the rendering
+    	virtual void 	renderShape(GemState *state);
+      virtual void  stopRendering(void);
+
+      t_outlet	*m_infoOut;
+      t_outlet	*m_dataOut;
+
+    private:
+
+      enum argKind {
+        ARG_UNSET,
+        ARG_VALUE,    // scalar or vector, by value
+        ARG_BUFFER,   // __global / __constant pointer
+        ARG_LOCAL,    // __local pointer
+        ARG_PIX,      // image : incoming or outgoing pix
+        ARG_TEXTURE   // image : GL texture
+      };
+
+      struct kernelArg {
+        std::string name;
+        std::string typeName;
+        cl_uint address;      // CL_KERNEL_ARG_ADDRESS_*
+        cl_uint access;       // CL_KERNEL_ARG_ACCESS_*
+        bool image;
+        // element type : base type, its size and the vector width
+        int elementType;
+        size_t elementSize;
+        int elementCount;
+
+        int kind;
+        // the value passed to clSetKernelArg() for ARG_VALUE
+        std::vector<unsigned char> value;
+        size_t localSize;
+        cl_mem mem;
+        size_t bufferSize;
+        // ARG_PIX : size and format of the image ; ARG_TEXTURE : the texture
+        int width, height;
+        GLenum format;
+        GLuint texId;
+        GLenum texTarget;
+        // clSetKernelArg() has to be called before the next launch
+        bool dirty;
+      };
+
+      bool initOpenCL();
+      bool startBuild();
+      void pollBuild();
+      bool introspect();
+      void releaseMem(kernelArg &arg);
+      kernelArg *findArg(const t_atom *atom);
+      void assumeType(kernelArg &arg, int type, int count, cl_uint address);
+      bool setValue(kernelArg &arg, int argc, t_atom *argv);
+      bool setBuffer(kernelArg &arg, int argc, t_atom *argv, size_t zeros);
+      bool preparePix(kernelArg &arg, const imageStruct *image, bool newImage);
+      bool prepareTexture(kernelArg &arg);
+      bool setArgs();
+      void outputPix(GemState *state, kernelArg &arg, const imageStruct &source);
+      void Cleanup();
+
+      std::string m_fileName;
+      std::string m_kernelName;
+      // stage functions fused into 'ocl_pipeline'
+      std::vector<std::string> m_pipeline;
+
+      // shared context, queue and device, owned by the runtime
+      oclRuntime *m_runtime;
+      // program being built in the background
+      oclRuntime::buildJob *m_build;
+      cl_program m_program;
+      // our own kernel, not the runtime's shared one : its arguments
+      // stay set between launches
+      cl_kernel m_kernel;
+
+      std::vector<kernelArg> m_args;
+      // 'arg' messages received before the kernel was built
+      std::vector<std::vector<t_atom> > m_pending;
+      // 0 : from the pix
+      size_t m_global[2];
+      // {0, 0} : the driver chooses
+      size_t m_local[2];
+
+      pixBlock m_pixBlock;
+};
+
+#endif	// for header file
@@ -0,0 +1,964 @@
+////////////////////////////////////////////////////////
+//
+// GEM - Graphics Environment for Multimedia
+//
+// zmoelnig@iem.kug.ac.at
+//
+// Implementation file
+//
+//    Copyright (c) 1997-2000 Mark Danks.
+//    Copyright (c) Günther Geiger.
+//    Copyright (c) 2001-2011 IOhannes m zmölnig. forum::für::umläute. IEM. zmoelnig@iem.at
+//    For information on usage and redistribution, and for a DISCLAIMER OF ALL
+//    WARRANTIES, see the file, "GEM.LICENSE.TERMS" in this distribution.
+//
+/////////////////////////////////////////////////////////
+
+#include "ocl_runtime.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#elif defined(__APPLE__)
+#include <OpenGL/OpenGL.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <GL/glx.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::map<oclRuntime::runtimeKey, oclRuntime*> oclRuntime::s_runtimes;
+unsigned int oclRuntime::s_cacheHits = 0;
+unsigned int oclRuntime::s_cacheMisses = 0;
+pthread_mutex_t oclRuntime::s_buildMutex = PTHREAD_MUTEX_INITIALIZER;
+std::map<std::string, std::pair<size_t, size_t> > oclRuntime::s_localSizes;
+bool oclRuntime::s_localSizesLoaded = false;
+
+// one compilation on a worker thread, shared by all the jobs asking for
+// the same source and options
+struct oclRuntime::pendingBuild {
+  oclRuntime *runtime;
+  std::string key;
+  std::string source;
+  std::string options;
+  cl_program program;
+  bool done;     // set by the worker, under s_buildMutex
+  bool joined;   // the worker is gone and the program is in the cache
+  int refs;      // jobs waiting for it
+  pthread_t thread;
+};
+
+struct oclRuntime::buildJob {
+  pendingBuild *build;  // NULL : the program was there already
+  cl_program program;
+};
+
+///
+//  Id of this process, for temporary file names
+//
+static long processId()
+{
+#ifdef _WIN32
+    return (long)GetCurrentProcessId();
+#else
+    return (long)getpid();
+#endif
+}
+
+///
+//  Handle of the GL context current on the calling thread
+//
+static void *currentGLContext()
+{
+#ifdef _WIN32
+  return (void*)wglGetCurrentContext();
+#elif defined(__APPLE__)
+  return (void*)CGLGetCurrentContext();
+#else
+  return (void*)glXGetCurrentContext();
+#endif
+}
+
+///
+//  Select the first GPU device of the first available platform,
+//  or its first CPU device if there is no GPU.
+//  OCL_DEVICE_TYPE=cpu|gpu in the environment picks the first device of
+//  that type on any platform instead (e.g. pocl next to a GPU driver)
+//
+static bool selectDevice(cl_platform_id *platform, cl_device_id *device)
+{
+    cl_int errNum;
+    cl_uint numPlatforms;
+
+    const char *type = getenv("OCL_DEVICE_TYPE");
+    if (type != NULL && *type)
+    {
+        cl_device_type wanted = std::string(type) == "cpu" ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU;
+        cl_platform_id platforms[16];
+        errNum = clGetPlatformIDs(16, platforms, &numPlatforms);
+        if (errNum == CL_SUCCESS)
+        {
+            for (cl_uint i = 0; i < numPlatforms && i < 16; i++)
+            {
+                if (clGetDeviceIDs(platforms[i], wanted, 1, device, NULL) == CL_SUCCESS)
+                {
+                    *platform = platforms[i];
+                    return true;
+                }
+            }
+        }
+        std::cerr << "Failed to find an OpenCL device of type '" << type << "'." << std::endl;
+        return false;
+    }
+
+    // First, select an OpenCL platform to run on.  For this example, we
+    // simply choose the first available platform.  Normally, you would
+    // query for all available platforms and select the most appropriate one.
+    errNum = clGetPlatformIDs(1, platform, &numPlatforms);
+    if (errNum != CL_SUCCESS || numPlatforms <= 0)
+    {
+        std::cerr << "Failed to find any OpenCL platforms." << std::endl;
+        return false;
+    }
+
+    errNum = clGetDeviceIDs(*platform, CL_DEVICE_TYPE_GPU, 1, device, NULL);
+    if (errNum != CL_SUCCESS)
+    {
+        std::cout << "Could not find a GPU device, trying CPU..." << std::endl;
+        errNum = clGetDeviceIDs(*platform, CL_DEVICE_TYPE_CPU, 1, device, NULL);
+        if (errNum != CL_SUCCESS)
+        {
+            std::cerr << "Failed to find an OpenCL GPU or CPU device." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+oclRuntime :: oclRuntime(void)
+  : m_refs(0),
+    m_platform(0),
+    m_device(0),
+    m_context(0),
+    m_queue(0),
+    m_profilingQueue(0)
+{
+}
+
+oclRuntime :: ~oclRuntime(void)
+{
+    std::map<std::string, programEntry>::iterator it;
+    for ( it = m_programs.begin(); it != m_programs.end(); ++it ){
+      std::map<std::string, cl_kernel>::iterator k;
+      for ( k = it->second.kernels.begin(); k != it->second.kernels.end(); ++k )
+        clReleaseKernel(k->second);
+      clReleaseProgram(it->second.program);
+    }
+
+    if (m_queue != 0)
+        clReleaseCommandQueue(m_queue);
+
+    if (m_profilingQueue != 0)
+        clReleaseCommandQueue(m_profilingQueue);
+
+    if (m_context != 0)
+        clReleaseContext(m_context);
+}
+
+///
+//  Create the context and the command queue on m_device
+//
+bool oclRuntime :: init(bool shareGL)
+{
+    cl_int errNum;
+
+    cl_context_properties contextProperties[] =
+    {
+        CL_CONTEXT_PLATFORM, (cl_context_properties)m_platform,
+        0, 0,
+        0, 0,
+        0
+    };
+    if ( shareGL ){
+#ifdef _WIN32
+      contextProperties[2] = CL_GL_CONTEXT_KHR;
+      contextProperties[3] = (cl_context_properties)wglGetCurrentContext();
+      contextProperties[4] = CL_WGL_HDC_KHR;
+      contextProperties[5] = (cl_context_properties)wglGetCurrentDC();
+#elif defined(__APPLE__)
+      //todo
+#else
+      contextProperties[2] = CL_GL_CONTEXT_KHR;
+      contextProperties[3] = (cl_context_properties)glXGetCurrentContext();
+      contextProperties[4] = CL_GLX_DISPLAY_KHR;
+      contextProperties[5] = (cl_context_properties)glXGetCurrentDisplay();
+#endif
+    }
+
+    m_context = clCreateContext(contextProperties, 1, &m_device, NULL, NULL, &errNum);
+    if (errNum != CL_SUCCESS)
+    {
+        std::cerr << "Failed to create an OpenCL context." << std::endl;
+        m_context = 0;
+        return false;
+    }
+
+    m_queue = clCreateCommandQueue(m_context, m_device, 0, &errNum);
+    if (m_queue == NULL)
+    {
+        std::cerr << "Failed to create commandQueue." << std::endl;
+        return false;
+    }
+
+    size_t size = 0;
+    if ( clGetDeviceInfo(m_device, CL_DEVICE_EXTENSIONS, 0, NULL, &size) == CL_SUCCESS && size ){
+      std::vector<char> extensions(size);
+      clGetDeviceInfo(m_device, CL_DEVICE_EXTENSIONS, size, &extensions[0], NULL);
+      m_extensions = std::string(&extensions[0]);
+    }
+
+    // identify the compiler for the binary cache
+    char info[256];
+    if ( clGetDeviceInfo(m_device, CL_DEVICE_NAME, sizeof(info), info, NULL) == CL_SUCCESS )
+      m_deviceName = info;
+    if ( clGetDeviceInfo(m_device, CL_DRIVER_VERSION, sizeof(info), info, NULL) == CL_SUCCESS )
+      m_driverVersion = info;
+
+    return true;
+}
+
+oclRuntime *oclRuntime :: acquire(bool shareGL)
+{
+    void *glContext = NULL;
+    if ( shareGL ){
+      glContext = currentGLContext();
+      if ( !glContext ){
+        std::cerr << "No current GL context to share with OpenCL." << std::endl;
+        return NULL;
+      }
+    }
+
+    cl_platform_id platform;
+    cl_device_id device;
+    if ( !selectDevice(&platform, &device) )
+      return NULL;
+
+    runtimeKey key(glContext, device);
+    std::map<runtimeKey, oclRuntime*>::iterator it = s_runtimes.find(key);
+    if ( it != s_runtimes.end() ){
+      it->second->m_refs++;
+      return it->second;
+    }
+
+    oclRuntime *runtime = new oclRuntime();
+    runtime->m_key = key;
+    runtime->m_platform = platform;
+    runtime->m_device = device;
+    if ( !runtime->init(shareGL) ){
+      delete runtime;
+      return NULL;
+    }
+    runtime->m_refs = 1;
+    s_runtimes[key] = runtime;
+    return runtime;
+}
+
+void oclRuntime :: release(oclRuntime *runtime)
+{
+    if ( !runtime ) return;
+    if ( --runtime->m_refs > 0 ) return;
+
+    s_runtimes.erase(runtime->m_key);
+    delete runtime;
+}
+
+cl_command_queue oclRuntime :: profilingQueue(void)
+{
+    if ( m_profilingQueue == 0 ){
+      m_profilingQueue = clCreateCommandQueue(m_context, m_device, CL_QUEUE_PROFILING_ENABLE, NULL);
+      if ( m_profilingQueue == 0 ){
+        std::cerr << "Failed to create profiling commandQueue." << std::endl;
+        return m_queue;
+      }
+    }
+    return m_profilingQueue;
+}
+
+double oclRuntime :: eventTime(cl_event event)
+{
+    return eventTime(event, event);
+}
+
+double oclRuntime :: eventTime(cl_event first, cl_event last)
+{
+    cl_ulong start = 0, end = 0;
+    if ( clGetEventProfilingInfo(first, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+         clGetEventProfilingInfo(last, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS )
+      return 0.;
+    return (end - start) * 1e-6;
+}
+
+bool oclRuntime :: hasExtension(const char *name) const
+{
+    return m_extensions.find(name) != std::string::npos;
+}
+
+bool oclRuntime :: readFile(const char *fileName, std::string &content)
+{
+    std::ifstream kernelFile(fileName, std::ios::in);
+    if (!kernelFile.is_open())
+    {
+        std::cerr << "Failed to open file for reading: " << fileName << std::endl;
+        return false;
+    }
+
+    std::ostringstream oss;
+    oss << kernelFile.rdbuf();
+    content = oss.str();
+    return true;
+}
+
+///
+//  Create an OpenCL program from source, or get it from the cache
+//
+cl_program oclRuntime :: getProgram(const std::string &source, const std::string &options)
+{
+    std::string key = options + '\0' + source;
+    // being built in the background : wait for it rather than build it twice
+    std::map<std::string, pendingBuild*>::iterator p = m_pending.find(key);
+    if ( p != m_pending.end() )
+      finishBuild(p->second);
+
+    std::map<std::string, programEntry>::iterator it = m_programs.find(key);
+    if ( it != m_programs.end() ){
+      it->second.refs++;
+      return it->second.program;
+    }
+
+    cl_program program = buildProgram(source, options);
+    if (program == NULL)
+      return NULL;
+
+    return registerProgram(key, program);
+}
+
+///
+//  Put a freshly built program in the cache, unless an identical one
+//  made it there in the meantime
+//
+cl_program oclRuntime :: registerProgram(const std::string &key, cl_program program)
+{
+    std::map<std::string, programEntry>::iterator it = m_programs.find(key);
+    if ( it != m_programs.end() ){
+      clReleaseProgram(program);
+      it->second.refs++;
+      return it->second.program;
+    }
+
+    programEntry &entry = m_programs[key];
+    entry.program = program;
+    entry.refs = 1;
+    return program;
+}
+
+void *oclRuntime :: buildThread(void *arg)
+{
+    pendingBuild *build = (pendingBuild*)arg;
+    cl_program program = build->runtime->buildProgram(build->source, build->options);
+
+    pthread_mutex_lock(&s_buildMutex);
+    build->program = program;
+    build->done = true;
+    pthread_mutex_unlock(&s_buildMutex);
+    return NULL;
+}
+
+///
+//  Join the worker and put its program in the cache, the build holding
+//  one reference to it until its last job is gone
+//
+void oclRuntime :: finishBuild(pendingBuild *build)
+{
+    if ( build->joined )
+      return;
+    pthread_join(build->thread, NULL);
+    build->joined = true;
+    m_pending.erase(build->key);
+    if ( build->program )
+      build->program = registerProgram(build->key, build->program);
+}
+
+oclRuntime::buildJob *oclRuntime :: getProgramAsync(const std::string &source, const std::string &options)
+{
+    buildJob *job = new buildJob;
+    job->build = NULL;
+    job->program = NULL;
+    std::string key = options + '\0' + source;
+
+    // already built : nothing to wait for
+    std::map<std::string, programEntry>::iterator it = m_programs.find(key);
+    if ( it != m_programs.end() ){
+      it->second.refs++;
+      job->program = it->second.program;
+      return job;
+    }
+
+    // already being built : wait for the same worker
+    std::map<std::string, pendingBuild*>::iterator p = m_pending.find(key);
+    if ( p != m_pending.end() ){
+      p->second->refs++;
+      job->build = p->second;
+      return job;
+    }
+
+    pendingBuild *build = new pendingBuild;
+    build->runtime = this;
+    build->key = key;
+    build->source = source;
+    build->options = options;
+    build->program = NULL;
+    build->done = false;
+    build->joined = false;
+    build->refs = 1;
+    if ( pthread_create(&build->thread, NULL, buildThread, build) != 0 ){
+      // no thread, build right now
+      std::cerr << "Failed to start build thread, building synchronously." << std::endl;
+      delete build;
+      job->program = getProgram(source, options);
+      return job;
+    }
+    m_pending[key] = build;
+    job->build = build;
+    return job;
+}
+
+bool oclRuntime :: pollProgram(buildJob *job, cl_program *program)
+{
+    pendingBuild *build = job->build;
+    if ( build ){
+      if ( !build->joined ){
+        pthread_mutex_lock(&s_buildMutex);
+        bool done = build->done;
+        pthread_mutex_unlock(&s_buildMutex);
+        if ( !done )
+          return false;
+        finishBuild(build);
+      }
+      // a reference of its own for every job
+      if ( build->program )
+        m_programs[build->key].refs++;
+      job->program = build->program;
+      if ( --build->refs == 0 ){
+        if ( build->program )
+          releaseProgram(build->program);
+        delete build;
+      }
+    }
+    *program = job->program;
+    delete job;
+    return true;
+}
+
+void oclRuntime :: cancelBuild(buildJob *job)
+{
+    pendingBuild *build = job->build;
+    if ( build ){
+      // the other jobs still want the program
+      if ( --build->refs == 0 ){
+        finishBuild(build);
+        if ( build->program )
+          releaseProgram(build->program);
+        delete build;
+      }
+    } else if ( job->program ){
+      releaseProgram(job->program);
+    }
+    delete job;
+}
+
+///
+//  Build a program, from the on-disk binary cache if possible.
+//  Programs built with -cl-kernel-arg-info always come from source :
+//  drivers are free to drop the argument info from a program binary
+//
+cl_program oclRuntime :: buildProgram(const std::string &source, const std::string &options)
+{
+    cl_int errNum;
+    cl_program program = NULL;
+    bool cached = options.find("-cl-kernel-arg-info") == std::string::npos;
+    std::string cacheFile = cached ? binaryCacheFile(source, options) : std::string();
+
+    if (cached)
+    {
+        // stale or rejected binaries are simply rebuilt from source
+        program = loadBinary(cacheFile, options);
+        pthread_mutex_lock(&s_buildMutex);
+        if (program != NULL)
+            s_cacheHits++;
+        else
+            s_cacheMisses++;
+        pthread_mutex_unlock(&s_buildMutex);
+        if (program != NULL)
+            return program;
+    }
+
+    const char *srcStr = source.c_str();
+    program = clCreateProgramWithSource(m_context, 1,
+                                        (const char**)&srcStr,
+                                        NULL, NULL);
+    if (program == NULL)
+    {
+        std::cerr << "Failed to create CL program from source." << std::endl;
+        return NULL;
+    }
+
+    errNum = clBuildProgram(program, 1, &m_device, options.c_str(), NULL, NULL);
+    if (errNum != CL_SUCCESS)
+    {
+        // Determine the reason for the error
+        char buildLog[16384];
+        clGetProgramBuildInfo(program, m_device, CL_PROGRAM_BUILD_LOG,
+                              sizeof(buildLog), buildLog, NULL);
+
+        std::cerr << "Error in kernel: " << std::endl;
+        std::cerr << buildLog;
+        clReleaseProgram(program);
+        return NULL;
+    }
+
+    if (cached)
+        saveBinary(program, cacheFile);
+    return program;
+}
+
+///
+//  Binary cache file for a program on this device :
+//  <cache dir>/<hash of source, options, device name and driver version>.bin
+//
+std::string oclRuntime :: binaryCacheFile(const std::string &source, const std::string &options)
+{
+    std::string dir = cacheDirectory();
+    if ( dir.empty() )
+      return "";
+
+    // 64 bit FNV-1a
+    const std::string parts[4] = { source, options, m_deviceName, m_driverVersion };
+    unsigned long long hash = 14695981039346656037ULL;
+    for ( int p = 0; p < 4; p++ ){
+      for ( size_t i = 0; i <= parts[p].size(); i++ ){
+        hash ^= (unsigned char)parts[p].c_str()[i];
+        hash *= 1099511628211ULL;
+      }
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", hash);
+    return dir + "/" + name;
+}
+
+///
+//  Per-user cache directory, created if needed
+//
+std::string oclRuntime :: cacheDirectory(void)
+{
+    std::string dir;
+#ifdef _WIN32
+    const char *base = getenv("LOCALAPPDATA");
+    if ( !base ) return "";
+    dir = std::string(base) + "/ocl";
+    _mkdir(dir.c_str());
+#else
+    const char *base = getenv("XDG_CACHE_HOME");
+    if ( base && *base ){
+      dir = base;
+    } else {
+      base = getenv("HOME");
+      if ( !base ) return "";
+      dir = std::string(base) + "/.cache";
+      mkdir(dir.c_str(), 0755);
+    }
+    dir += "/ocl";
+    mkdir(dir.c_str(), 0755);
+#endif
+    return dir;
+}
+
+cl_program oclRuntime :: loadBinary(const std::string &cacheFile, const std::string &options)
+{
+    if ( cacheFile.empty() )
+      return NULL;
+
+    std::ifstream file(cacheFile.c_str(), std::ios::in | std::ios::binary);
+    if ( !file.is_open() )
+      return NULL;
+    std::vector<unsigned char> binary((std::istreambuf_iterator<char>(file)),
+                                      std::istreambuf_iterator<char>());
+    if ( binary.empty() )
+      return NULL;
+
+    cl_int errNum, binaryStatus;
+    size_t size = binary.size();
+    const unsigned char *data = &binary[0];
+    cl_program program = clCreateProgramWithBinary(m_context, 1, &m_device, &size, &data,
+                                                   &binaryStatus, &errNum);
+    if ( errNum != CL_SUCCESS || binaryStatus != CL_SUCCESS )
+    {
+      if ( program ) clReleaseProgram(program);
+      return NULL;
+    }
+
+    if ( clBuildProgram(program, 1, &m_device, options.c_str(), NULL, NULL) != CL_SUCCESS )
+    {
+      clReleaseProgram(program);
+      return NULL;
+    }
+    return program;
+}
+
+void oclRuntime :: saveBinary(cl_program program, const std::string &cacheFile)
+{
+    if ( cacheFile.empty() )
+      return;
+
+    size_t size = 0;
+    if ( clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, NULL) != CL_SUCCESS || !size )
+      return;
+    std::vector<unsigned char> binary(size);
+    unsigned char *data = &binary[0];
+    if ( clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(data), &data, NULL) != CL_SUCCESS )
+      return;
+
+    // write to a temporary file first, so a concurrent reader never sees half a binary.
+    // one per writer : other threads or processes may save the same binary
+    static unsigned int s_tmpCount = 0;
+    pthread_mutex_lock(&s_buildMutex);
+    unsigned int count = s_tmpCount++;
+    pthread_mutex_unlock(&s_buildMutex);
+    std::ostringstream tmpName;
+    tmpName << cacheFile << "." << processId() << "." << count << ".tmp";
+    std::string tmpFile = tmpName.str();
+    std::ofstream file(tmpFile.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if ( !file.is_open() )
+      return;
+    file.write((const char*)data, size);
+    file.close();
+    if ( file.fail() || rename(tmpFile.c_str(), cacheFile.c_str()) != 0 )
+      remove(tmpFile.c_str());
+}
+
+void oclRuntime :: globalSize(const size_t domain[2], const size_t local[2], size_t global[2])
+{
+    for ( int i = 0; i < 2; i++ ){
+      global[i] = domain[i];
+      if ( local[0] && local[i] )
+        global[i] = (domain[i] + local[i] - 1) / local[i] * local[i];
+    }
+}
+
+///
+//  <device name>|<driver version>|<kernel name>|<width>x<height>
+//
+std::string oclRuntime :: localSizeKey(cl_kernel kernel, const size_t domain[2])
+{
+    char name[256] = "";
+    clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name), name, NULL);
+    std::ostringstream key;
+    key << m_deviceName << "|" << m_driverVersion << "|" << name << "|"
+        << domain[0] << "x" << domain[1];
+    return key.str();
+}
+
+///
+//  One '<key>\t<x> <y>' line per tuned kernel
+//
+void oclRuntime :: loadLocalSizes(void)
+{
+    s_localSizesLoaded = true;
+    std::string dir = cacheDirectory();
+    if ( dir.empty() )
+      return;
+    std::ifstream file((dir + "/worksizes").c_str());
+    std::string line;
+    while ( std::getline(file, line) ){
+      size_t tab = line.rfind('\t');
+      if ( tab == std::string::npos ) continue;
+      std::istringstream sizes(line.substr(tab + 1));
+      size_t x, y;
+      if ( sizes >> x >> y )
+        s_localSizes[line.substr(0, tab)] = std::make_pair(x, y);
+    }
+}
+
+void oclRuntime :: saveLocalSizes(void)
+{
+    std::string dir = cacheDirectory();
+    if ( dir.empty() )
+      return;
+    std::string fileName = dir + "/worksizes";
+    std::string tmpFile = fileName + ".tmp";
+    std::ofstream file(tmpFile.c_str(), std::ios::out | std::ios::trunc);
+    if ( !file.is_open() )
+      return;
+    std::map<std::string, std::pair<size_t, size_t> >::iterator it;
+    for ( it = s_localSizes.begin(); it != s_localSizes.end(); ++it )
+      file << it->first << "\t" << it->second.first << " " << it->second.second << "\n";
+    file.close();
+    if ( file.fail() || rename(tmpFile.c_str(), fileName.c_str()) != 0 )
+      remove(tmpFile.c_str());
+}
+
+bool oclRuntime :: storedLocalSize(cl_kernel kernel, const size_t domain[2], size_t local[2])
+{
+    if ( !s_localSizesLoaded )
+      loadLocalSizes();
+    std::map<std::string, std::pair<size_t, size_t> >::iterator it = s_localSizes.find(localSizeKey(kernel, domain));
+    if ( it == s_localSizes.end() )
+      return false;
+    local[0] = it->second.first;
+    local[1] = it->second.second;
+    return true;
+}
+
+bool oclRuntime :: tuneLocalSize(cl_kernel kernel, const size_t domain[2], size_t local[2], double *ms)
+{
+    static const size_t candidates[][2] = {
+      { 0, 0 },
+      { 8, 4 }, { 8, 8 }, { 16, 4 }, { 16, 8 }, { 16, 16 },
+      { 32, 1 }, { 32, 4 }, { 32, 8 }, { 64, 1 }, { 64, 4 },
+      { 128, 1 }, { 256, 1 }
+    };
+    const int numCandidates = sizeof(candidates) / sizeof(candidates[0]);
+    const int runs = 5;
+
+    size_t maxGroup = 0, maxItems[3] = { 0, 0, 0 };
+    clGetKernelWorkGroupInfo(kernel, m_device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(maxGroup), &maxGroup, NULL);
+    clGetDeviceInfo(m_device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, NULL);
+
+    cl_command_queue queue = profilingQueue();
+    double best = -1.;
+    for ( int c = 0; c < numCandidates; c++ ){
+      const size_t *candidate = candidates[c];
+      if ( candidate[0] && ( candidate[0] * candidate[1] > maxGroup ||
+                             candidate[0] > maxItems[0] || candidate[1] > maxItems[1] ) )
+        continue;
+
+      size_t global[2];
+      globalSize(domain, candidate, global);
+      // the first run is a warm-up
+      cl_event events[runs + 1];
+      int enqueued = 0;
+      for ( ; enqueued <= runs; enqueued++ ){
+        if ( clEnqueueNDRangeKernel(queue, kernel, 2, NULL, global, candidate[0] ? candidate : NULL,
+                                    0, NULL, &events[enqueued]) != CL_SUCCESS )
+          break;
+      }
+      clFinish(queue);
+
+      if ( enqueued > runs ){
+        std::vector<double> times;
+        for ( int i = 1; i <= runs; i++ )
+          times.push_back(eventTime(events[i]));
+        std::sort(times.begin(), times.end());
+        double median = times[runs / 2];
+        if ( best < 0. || median < best ){
+          best = median;
+          local[0] = candidate[0];
+          local[1] = candidate[1];
+        }
+      }
+      for ( int i = 0; i < enqueued; i++ )
+        clReleaseEvent(events[i]);
+    }
+    if ( best < 0. )
+      return false;
+
+    if ( !s_localSizesLoaded )
+      loadLocalSizes();
+    s_localSizes[localSizeKey(kernel, domain)] = std::make_pair(local[0], local[1]);
+    saveLocalSizes();
+    if ( ms ) *ms = best;
+    return true;
+}
+
+cl_program oclRuntime :: getProgramFromFile(const char *fileName, const std::string &options)
+{
+    std::string source;
+    if ( !readFile(fileName, source) )
+      return NULL;
+    return getProgram(source, options);
+}
+
+void oclRuntime :: releaseProgram(cl_program program)
+{
+    std::map<std::string, programEntry>::iterator it;
+    for ( it = m_programs.begin(); it != m_programs.end(); ++it ){
+      if ( it->second.program != program ) continue;
+      if ( --it->second.refs > 0 ) return;
+
+      std::map<std::string, cl_kernel>::iterator k;
+      for ( k = it->second.kernels.begin(); k != it->second.kernels.end(); ++k )
+        clReleaseKernel(k->second);
+      clReleaseProgram(program);
+      m_programs.erase(it);
+      return;
+    }
+}
+
+cl_kernel oclRuntime :: getKernel(cl_program program, const char *name)
+{
+    std::map<std::string, programEntry>::iterator it;
+    for ( it = m_programs.begin(); it != m_programs.end(); ++it ){
+      if ( it->second.program != program ) continue;
+
+      std::map<std::string, cl_kernel>::iterator k = it->second.kernels.find(name);
+      if ( k != it->second.kernels.end() )
+        return k->second;
+
+      cl_kernel kernel = clCreateKernel(program, name, NULL);
+      if ( kernel == NULL ){
+        std::cerr << "Failed to create kernel " << name << std::endl;
+        return NULL;
+      }
+      it->second.kernels[name] = kernel;
+      return kernel;
+    }
+    return NULL;
+}
+
+/////////////////////////////////////////////////////////
+//
+// oclTimings
+//
+/////////////////////////////////////////////////////////
+oclTimings :: oclTimings(size_t window)
+  : m_next(0),
+    m_window(window)
+{
+}
+
+void oclTimings :: add(double ms)
+{
+    if ( m_samples.size() < m_window ){
+      m_samples.push_back(ms);
+    } else {
+      m_samples[m_next] = ms;
+    }
+    m_next = (m_next + 1) % m_window;
+}
+
+void oclTimings :: clear(void)
+{
+    m_samples.clear();
+    m_next = 0;
+}
+
+double oclTimings :: min(void) const
+{
+    if ( m_samples.empty() ) return 0.;
+    return *std::min_element(m_samples.begin(), m_samples.end());
+}
+
+double oclTimings :: mean(void) const
+{
+    if ( m_samples.empty() ) return 0.;
+    double sum = 0.;
+    for ( size_t i = 0; i < m_samples.size(); i++ )
+      sum += m_samples[i];
+    return sum / m_samples.size();
+}
+
+double oclTimings :: percentile(double p) const
+{
+    if ( m_samples.empty() ) return 0.;
+    std::vector<double> sorted(m_samples);
+    size_t n = (size_t)(p / 100. * (sorted.size() - 1) + 0.5);
+    std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+    return sorted[n];
+}
+
+/////////////////////////////////////////////////////////
+//
+// oclBufferPool
+//
+/////////////////////////////////////////////////////////
+oclBufferPool :: oclBufferPool(size_t maxBytes)
+  : m_retained(0),
+    m_maxBytes(maxBytes)
+{
+}
+
+oclBufferPool :: ~oclBufferPool(void)
+{
+    clear();
+}
+
+cl_mem oclBufferPool :: get(cl_context context, cl_mem_flags flags, size_t size)
+{
+    std::list<entry>::iterator it;
+    for ( it = m_free.begin(); it != m_free.end(); ++it ){
+      if ( it->context != context || it->flags != flags || it->size != size ) continue;
+      cl_mem mem = it->mem;
+      m_retained -= it->size;
+      m_free.erase(it);
+      return mem;
+    }
+    return clCreateBuffer(context, flags, size, NULL, NULL);
+}
+
+void oclBufferPool :: put(cl_mem mem)
+{
+    if ( mem == 0 )
+      return;
+    entry e;
+    e.mem = mem;
+    if ( clGetMemObjectInfo(mem, CL_MEM_CONTEXT, sizeof(e.context), &e.context, NULL) != CL_SUCCESS ||
+         clGetMemObjectInfo(mem, CL_MEM_FLAGS, sizeof(e.flags), &e.flags, NULL) != CL_SUCCESS ||
+         clGetMemObjectInfo(mem, CL_MEM_SIZE, sizeof(e.size), &e.size, NULL) != CL_SUCCESS ){
+      clReleaseMemObject(mem);
+      return;
+    }
+    m_free.push_front(e);
+    m_retained += e.size;
+
+    while ( m_retained > m_maxBytes && !m_free.empty() ){
+      m_retained -= m_free.back().size;
+      clReleaseMemObject(m_free.back().mem);
+      m_free.pop_back();
+    }
+}
+
+void oclBufferPool :: clear(void)
+{
+    std::list<entry>::iterator it;
+    for ( it = m_free.begin(); it != m_free.end(); ++it )
+      clReleaseMemObject(it->mem);
+    m_free.clear();
+    m_retained = 0;
+}
+
+/////////////////////////////////////////////////////////
+//
+// host helpers
+//
+/////////////////////////////////////////////////////////
+void oclUnpackMask(const cl_uint *src, unsigned char *dst, int width, int height)
+{
+  int words = (width+31)/32;
+  for ( int j = 0; j < height; j++ ){
+    const cl_uint *row = src + words * j;
+    for ( int i = 0; i < width; i++ ){
+      *dst++ = ( row[i>>5] >> (i&31) ) & 1 ? 255 : 0;
+    }
+  }
+}
@@ -0,0 +1,257 @@
+/*-----------------------------------------------------------------
+LOG
+    GEM - Graphics Environment for Multimedia
+
+    ocl_runtime - OpenCL context shared by all ocl objects
+
+    Copyright (c) 1997-2000 Mark Danks. mark@danks.org
+    Copyright (c) Günther Geiger. geiger@epy.co.at
+    Copyright (c) 2001-2011 IOhannes m zmölnig. forum::für::umläute. IEM. zmoelnig@iem.at
+    For information on usage and redistribution, and for a DISCLAIMER OF ALL
+    WARRANTIES, see the file, "GEM.LICENSE.TERMS" in this distribution.
+
+-----------------------------------------------------------------*/
+
+#ifndef _INCLUDE__OCL_RUNTIME_H_
+#define _INCLUDE__OCL_RUNTIME_H_
+
+#include <string>
+#include <map>
+#include <vector>
+#include <list>
+#include <pthread.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#include <OpenCL/cl_gl.h>
+#else
+#include <CL/cl.h>
+#include <CL/cl_gl.h>
+#endif
+
+
+/*-----------------------------------------------------------------
+-------------------------------------------------------------------
+CLASS
+    oclRuntime
+
+    process-wide OpenCL runtime
+
+DESCRIPTION
+
+    one context, command queue and device per (GL context, device) pair,
+    reference counted and shared by every ocl object.
+    built programs are cached by source and build options, and their
+    kernels by name.
+    program binaries are also cached on disk (~/.cache/ocl), keyed by
+    source, build options, device name and driver version.
+    programs can be built on a worker thread, so that the render thread
+    never waits for the compiler.
+
+    cached kernels are shared between objects : always set all the
+    arguments right before enqueueing them.
+
+    no Pd or Gem dependency in here, errors go to std::cerr
+
+-----------------------------------------------------------------*/
+class oclRuntime
+{
+  public:
+
+    //////////
+    // Get the runtime for the current GL context (shareGL),
+    // or a plain one without GL interop
+    static oclRuntime *acquire(bool shareGL);
+    static void release(oclRuntime *runtime);
+
+    cl_context       context(void) const { return m_context; }
+    cl_command_queue queue(void)   const { return m_queue; }
+    cl_device_id     device(void)  const { return m_device; }
+    cl_platform_id   platform(void) const { return m_platform; }
+    const std::string &deviceName(void) const { return m_deviceName; }
+
+    //////////
+    // Second queue on the same device with CL_QUEUE_PROFILING_ENABLE,
+    // created on first use
+    cl_command_queue profilingQueue(void);
+    // execution time of a command enqueued on the profiling queue, in ms
+    static double eventTime(cl_event event);
+    // from the start of 'first' to the end of 'last', in ms
+    static double eventTime(cl_event first, cl_event last);
+
+    bool hasExtension(const char *name) const;
+
+    //////////
+    // Programs : each get has to be balanced with a releaseProgram()
+    cl_program getProgram(const std::string &source, const std::string &options = "");
+    cl_program getProgramFromFile(const char *fileName, const std::string &options = "");
+    void releaseProgram(cl_program program);
+
+    //////////
+    // Asynchronous programs : the build runs on a worker thread.
+    // Poll the job from the render thread : pollProgram() returns false
+    // while it is running, then hands over the program (NULL if the build
+    // failed) exactly like getProgram() would, and frees the job.
+    // requests for a program already being built wait for that build
+    // instead of starting another one.
+    struct buildJob;
+    buildJob *getProgramAsync(const std::string &source, const std::string &options = "");
+    bool pollProgram(buildJob *job, cl_program *program);
+    // wait for the worker and drop its result
+    void cancelBuild(buildJob *job);
+
+    //////////
+    // Kernels are owned by the cache, do not release them
+    cl_kernel getKernel(cl_program program, const char *name);
+
+    static bool readFile(const char *fileName, std::string &content);
+
+    //////////
+    // Work-group sizes for 2D kernels.
+    // local = {0, 0} lets the driver choose (NULL local size).
+    // The global size is padded to a multiple of the local size, so
+    // kernels have to check their ids against the domain.
+    static void globalSize(const size_t domain[2], const size_t local[2], size_t global[2]);
+    // local size found by tuneLocalSize() for this kernel, device, driver
+    // and domain, in this or an earlier run
+    bool storedLocalSize(cl_kernel kernel, const size_t domain[2], size_t local[2]);
+    // time the kernel (all arguments set) with every candidate local size
+    // on the profiling queue, store the fastest one and return it in local
+    bool tuneLocalSize(cl_kernel kernel, const size_t domain[2], size_t local[2], double *ms = NULL);
+
+    //////////
+    // On-disk cache of program binaries, shared by the whole process
+    static unsigned int binaryCacheHits(void) { return s_cacheHits; }
+    static unsigned int binaryCacheMisses(void) { return s_cacheMisses; }
+
+  private:
+
+    oclRuntime(void);
+    ~oclRuntime(void);
+
+    bool init(bool shareGL);
+
+    cl_program buildProgram(const std::string &source, const std::string &options);
+    cl_program registerProgram(const std::string &key, cl_program program);
+    struct pendingBuild;
+    static void *buildThread(void *build);
+    void finishBuild(pendingBuild *build);
+    std::string binaryCacheFile(const std::string &source, const std::string &options);
+    static std::string cacheDirectory(void);
+    cl_program loadBinary(const std::string &cacheFile, const std::string &options);
+    void saveBinary(cl_program program, const std::string &cacheFile);
+    std::string localSizeKey(cl_kernel kernel, const size_t domain[2]);
+    static void loadLocalSizes(void);
+    static void saveLocalSizes(void);
+
+    struct programEntry {
+      cl_program program;
+      int refs;
+      std::map<std::string, cl_kernel> kernels;
+    };
+
+    typedef std::pair<void*, cl_device_id> runtimeKey;
+    static std::map<runtimeKey, oclRuntime*> s_runtimes;
+    static unsigned int s_cacheHits, s_cacheMisses;
+    // guards the cache counters and the build jobs' results
+    static pthread_mutex_t s_buildMutex;
+    // tuned work-group sizes, <cache dir>/worksizes
+    static std::map<std::string, std::pair<size_t, size_t> > s_localSizes;
+    static bool s_localSizesLoaded;
+
+    runtimeKey m_key;
+    int m_refs;
+
+    cl_platform_id   m_platform;
+    cl_device_id     m_device;
+    cl_context       m_context;
+    cl_command_queue m_queue;
+    cl_command_queue m_profilingQueue;
+    std::string      m_extensions;
+    std::string      m_deviceName;
+    std::string      m_driverVersion;
+
+    std::map<std::string, programEntry> m_programs;
+    // builds running on a worker thread, by cache key
+    std::map<std::string, pendingBuild*> m_pending;
+};
+
+/*-----------------------------------------------------------------
+-------------------------------------------------------------------
+CLASS
+    oclTimings
+
+    rolling window of timings
+
+DESCRIPTION
+
+    keeps the last 'window' samples (in ms) of one processing stage
+
+-----------------------------------------------------------------*/
+class oclTimings
+{
+  public:
+    oclTimings(size_t window = 120);
+
+    void add(double ms);
+    void clear(void);
+    size_t count(void) const { return m_samples.size(); }
+
+    double min(void) const;
+    double mean(void) const;
+    // p in [0, 100]
+    double percentile(double p) const;
+
+  private:
+    std::vector<double> m_samples;
+    size_t m_next;
+    size_t m_window;
+};
+
+/*-----------------------------------------------------------------
+-------------------------------------------------------------------
+CLASS
+    oclBufferPool
+
+    recycles device buffers
+
+DESCRIPTION
+
+    buffers given back with put() are kept, and handed out again by get()
+    for the same context, flags and size : switching back and forth between
+    a few frame sizes does not allocate anything after the first switch.
+    least recently returned buffers are released first once more than
+    'maxBytes' are retained; clear() releases all of them.
+
+-----------------------------------------------------------------*/
+class oclBufferPool
+{
+  public:
+    oclBufferPool(size_t maxBytes = 128 << 20);
+    ~oclBufferPool(void);
+
+    cl_mem get(cl_context context, cl_mem_flags flags, size_t size);
+    void put(cl_mem mem);
+    void clear(void);
+
+    size_t retained(void) const { return m_retained; }
+
+  private:
+    struct entry {
+      cl_mem mem;
+      cl_context context;
+      cl_mem_flags flags;
+      size_t size;
+    };
+    // most recently returned first
+    std::list<entry> m_free;
+    size_t m_retained;
+    size_t m_maxBytes;
+};
+
+//////////
+// Expand a packed mask (1 bit per pixel, rows padded to 32 bits)
+// to 0/255 bytes
+void oclUnpackMask(const cl_uint *src, unsigned char *dst, int width, int height);
+
+#endif	// for header file
@@ -20,148 +20,6 @@ const int ARRAY_SIZE = 100;
 
 CPPEXTERN_NEW_WITH_ONE_ARG(ocl_test, t_floatarg, A_DEFFLOAT);
 
-///
-//  Create an OpenCL context on the first available platform using
-//  either a GPU or CPU depending on what is available.
-//
-cl_context ocl_test :: CreateContext()
-{
-    cl_int errNum;
-    cl_platform_id firstPlatformId;
-    cl_context context = NULL;
-
-    // First, select an OpenCL platform to run on.  For this example, we
-    // simply choose the first available platform.  Normally, you would
-    // query for all available platforms and select the most appropriate one.
-    errNum = clGetPlatformIDs(1, &firstPlatformId, &numPlatforms);
-    if (errNum != CL_SUCCESS || numPlatforms <= 0)
-    {
-        std::cerr << "Failed to find any OpenCL platforms." << std::endl;
-        return NULL;
-    }
-
-    // Next, create an OpenCL context on the platform.  Attempt to
-    // create a GPU-based context, and if that fails, try to create
-    // a CPU-based context.
-    cl_context_properties contextProperties[] =
-    {
-        CL_CONTEXT_PLATFORM,
-        (cl_context_properties)firstPlatformId,
-        0
-    };
-    context = clCreateContextFromType(contextProperties, CL_DEVICE_TYPE_GPU,
-                                      NULL, NULL, &errNum);
-    if (errNum != CL_SUCCESS)
-    {
-        std::cout << "Could not create GPU context, trying CPU..." << std::endl;
-        context = clCreateContextFromType(contextProperties, CL_DEVICE_TYPE_CPU,
-                                          NULL, NULL, &errNum);
-        if (errNum != CL_SUCCESS)
-        {
-            std::cerr << "Failed to create an OpenCL GPU or CPU context." << std::endl;
-            return NULL;
-        }
-    }
-
-    return context;
-}
-///
-//  Create a command queue on the first device available on the
-//  context
-//
-cl_command_queue ocl_test :: CreateCommandQueue(cl_context context, cl_device_id *device)
-{
-    cl_int errNum;
-    cl_device_id *devices;
-    cl_command_queue commandQueue = NULL;
-    size_t deviceBufferSize = -1;
-
-    // First get the size of the devices buffer
-    errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &deviceBufferSize);
-    if (errNum != CL_SUCCESS)
-    {
-        std::cerr << "Failed call to clGetContextInfo(...,GL_CONTEXT_DEVICES,...)";
-        return NULL;
-    }
-
-    if (deviceBufferSize <= 0)
-    {
-        std::cerr << "No devices available.";
-        return NULL;
-    }
-
-    // Allocate memory for the devices buffer
-    devices = new cl_device_id[deviceBufferSize / sizeof(cl_device_id)];
-    errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, deviceBufferSize, devices, NULL);
-    if (errNum != CL_SUCCESS)
-    {
-        delete [] devices;
-        std::cerr << "Failed to get device IDs";
-        return NULL;
-    }
-
-    // In this example, we just choose the first available device.  In a
-    // real program, you would likely use all available devices or choose
-    // the highest performance device based on OpenCL device queries
-    commandQueue = clCreateCommandQueue(context, devices[0], 0, NULL);
-    if (commandQueue == NULL)
-    {
-        delete [] devices;
-        std::cerr << "Failed to create commandQueue for device 0";
-        return NULL;
-    }
-
-    *device = devices[0];
-    delete [] devices;
-    return commandQueue;
-}
-
-///
-//  Create an OpenCL program from the kernel source file
-//
-cl_program ocl_test :: CreateProgram(cl_context context, cl_device_id device, const char* fileName)
-{
-    cl_int errNum;
-    cl_program program;
-
-    std::ifstream kernelFile(fileName, std::ios::in);
-    if (!kernelFile.is_open())
-    {
-        std::cerr << "Failed to open file for reading: " << fileName << std::endl;
-        return NULL;
-    }
-
-    std::ostringstream oss;
-    oss << kernelFile.rdbuf();
-
-    std::string srcStdStr = oss.str();
-    const char *srcStr = srcStdStr.c_str();
-    program = clCreateProgramWithSource(context, 1,
-                                        (const char**)&srcStr,
-                                        NULL, NULL);
-    if (program == NULL)
-    {
-        std::cerr << "Failed to create CL program from source." << std::endl;
-        return NULL;
-    }
-
-    errNum = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if (errNum != CL_SUCCESS)
-    {
-        // Determine the reason for the error
-        char buildLog[16384];
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG,
-                              sizeof(buildLog), buildLog, NULL);
-
-        std::cerr << "Error in kernel: " << std::endl;
-        std::cerr << buildLog;
-        clReleaseProgram(program);
-        return NULL;
-    }
-
-    return program;
-}
-
 ///
 //  Create memory objects used as the arguments to the kernel
 //  The kernel takes three arguments: result (output), a (input),
@@ -180,6 +38,13 @@ bool ocl_test :: CreateMemObjects(cl_context context, cl_mem memObjects[3],
     if (memObjects[0] == NULL || memObjects[1] == NULL || memObjects[2] == NULL)
     {
         std::cerr << "Error creating memory objects." << std::endl;
+        // try again on the next render
+        for (int i = 0; i < 3; i++)
+        {
+            if (memObjects[i] != 0)
+                clReleaseMemObject(memObjects[i]);
+            memObjects[i] = 0;
+        }
         return false;
     }
 
@@ -189,26 +54,22 @@ bool ocl_test :: CreateMemObjects(cl_context context, cl_mem memObjects[3],
 ///
 //  Cleanup any created OpenCL resources
 //
-void ocl_test :: Cleanup(cl_context context, cl_command_queue commandQueue,
-             cl_program program, cl_kernel kernel, cl_mem memObjects[3])
+void ocl_test :: Cleanup(cl_program program, cl_mem memObjects[3])
 {
     for (int i = 0; i < 3; i++)
     {
         if (memObjects[i] != 0)
             clReleaseMemObject(memObjects[i]);
     }
-    if (commandQueue != 0)
-        clReleaseCommandQueue(commandQueue);
 
-    if (kernel != 0)
-        clReleaseKernel(kernel);
+    if (m_build != NULL)
+        m_runtime->cancelBuild(m_build);
 
+    // the kernel belongs to the runtime's program cache
     if (program != 0)
-        clReleaseProgram(program);
-
-    if (context != 0)
-        clReleaseContext(context);
+        m_runtime->releaseProgram(program);
 
+    oclRuntime::release(m_runtime);
 }
 
 /////////////////////////////////////////////////////////
@@ -221,48 +82,36 @@ void ocl_test :: Cleanup(cl_context context, cl_command_queue commandQueue,
 /////////////////////////////////////////////////////////
 ocl_test :: ocl_test(t_floatarg size)
         : GemShape(size),
-        numPlatforms(0),
+        m_runtime(NULL),
+        m_build(NULL),
         context(NULL),
         commandQueue(0),
         program(0),
         device(0),
-        kernel(0),
-        memObjects({0,0,0})
+        kernel(0)
 { 
-    cl_int errNum;
+    for (int i = 0; i < 3; i++)
+        memObjects[i] = 0;
 
-    // Create an OpenCL context on first available platform
-    // Create an OpenCL context on first available platform
-    context = CreateContext();
-    if (context == NULL)
+    // Get the shared OpenCL context (no GL interop needed here)
+    m_runtime = oclRuntime::acquire(false);
+    if (m_runtime == NULL)
     {
         throw(GemException("Failed to create OpenCL context."));
     }
+    context = m_runtime->context();
+    commandQueue = m_runtime->queue();
+    device = m_runtime->device();
 
-    // Create a command-queue on the first device available
-    // on the created context
-    commandQueue = CreateCommandQueue(context, &device);
-    if (commandQueue == NULL)
+    // Create OpenCL program from HelloWorld.cl kernel source,
+    // the build itself runs in the background
+    std::string source;
+    if (!oclRuntime::readFile("HelloWorld.cl", source))
     {
-        Cleanup(context, commandQueue, program, kernel, memObjects);
-        throw(GemException("Failed to create command cue."));
-    }
-
-    // Create OpenCL program from HelloWorld.cl kernel source
-    program = CreateProgram(context, device, "HelloWorld.cl");
-    if (program == NULL)
-    {
-        Cleanup(context, commandQueue, program, kernel, memObjects);
+        Cleanup(program, memObjects);
         throw(GemException("Failed to create OpenCL program."));
     }
-
-    // Create OpenCL kernel
-    kernel = clCreateKernel(program, "hello_kernel", NULL);
-    if (kernel == NULL)
-    {
-        Cleanup(context, commandQueue, program, kernel, memObjects);
-        throw(GemException("Failed to create kernel"));
-    }
+    m_build = m_runtime->getProgramAsync(source);
     
     for (int i = 0; i < ARRAY_SIZE; i++)
     {
@@ -277,7 +126,7 @@ ocl_test :: ocl_test(t_floatarg size)
 /////////////////////////////////////////////////////////
 ocl_test :: ~ocl_test()
 {
-  Cleanup(context, commandQueue, program, kernel, memObjects);
+  Cleanup(program, memObjects);
 }
 
 /////////////////////////////////////////////////////////
@@ -299,8 +148,27 @@ void ocl_test :: renderShape(GemState *state)
     SetVertex(state, -m_size,  m_size, 0.0f,0.,1.,3);
 
     glEnd();
+
+    // Create OpenCL kernel once the program is built
+    if (m_build != NULL)
+    {
+        if (!m_runtime->pollProgram(m_build, &program))
+            return;
+        m_build = NULL;
+        if (program == NULL)
+        {
+            error("Failed to create OpenCL program.");
+            return;
+        }
+        kernel = m_runtime->getKernel(program, "hello_kernel");
+        if (kernel == NULL)
+            error("Failed to create kernel");
+    }
+    if (kernel == NULL)
+        return;
     
-    if (!CreateMemObjects(context, memObjects, a, b))
+    // the inputs never change : the buffers are created once and kept
+    if (memObjects[0] == 0 && !CreateMemObjects(context, memObjects, a, b))
     {
       error("can't create Mem Object");
       return;
@@ -319,11 +187,11 @@ void ocl_test :: renderShape(GemState *state)
     }
 
     size_t globalWorkSize[1] = { ARRAY_SIZE };
-    size_t localWorkSize[1] = { 1 };
 
-    // Queue the kernel up for execution across the array
+    // Queue the kernel up for execution across the array,
+    // the driver picks the work-group size
     errNum = clEnqueueNDRangeKernel(commandQueue, kernel, 1, NULL,
-                                    globalWorkSize, localWorkSize,
+                                    globalWorkSize, NULL,
                                     0, NULL, NULL);
     if (errNum != CL_SUCCESS)
     {
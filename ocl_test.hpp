@@ -19,17 +19,12 @@ LOG
 #include "Gem/State.h"
 #include "Gem/Exception.h"
 
+#include "ocl_runtime.hpp"
+
 #include <iostream>
 #include <fstream>
 #include <sstream>
 
-#ifdef __APPLE__
-#include <OpenCL/cl.h>
-#else
-#include <CL/cl.h>
-#include <CL/cl_gl.h>
-#endif
-
 
 /*-----------------------------------------------------------------
 -------------------------------------------------------------------
@@ -63,16 +58,15 @@ class GEM_EXTERN ocl_test : public GemShape
     	//////////
     	// Do the rendering
     	virtual void 	renderShape(GemState *state);
-      cl_context CreateContext();
-      cl_command_queue CreateCommandQueue(cl_context context, cl_device_id *device);
-      cl_program CreateProgram(cl_context context, cl_device_id device, const char* fileName);
       bool CreateMemObjects(cl_context context, cl_mem memObjects[3],
                       float *a, float *b);
-      void Cleanup(cl_context context, cl_command_queue commandQueue,
-             cl_program program, cl_kernel kernel, cl_mem memObjects[3]);
+      void Cleanup(cl_program program, cl_mem memObjects[3]);
     
     private:
-      cl_uint numPlatforms;
+      // shared context, queue and device, owned by the runtime
+      oclRuntime *m_runtime;
+      // program being built in the background
+      oclRuntime::buildJob *m_build;
       cl_context context;
       cl_command_queue commandQueue;
       cl_program program;
@@ -1,13 +1,612 @@
-__kernel void process_texture_kernel(__read_only image2d_t im, __global bool *dst, int w, int h)
-{
-  sampler_t srcSampler = CLK_NORMALIZED_COORDS_FALSE | 
+__constant sampler_t srcSampler = CLK_NORMALIZED_COORDS_FALSE |
         CLK_ADDRESS_CLAMP_TO_EDGE |
         CLK_FILTER_NEAREST ;
-        
+
+// classifier settings, set by the host as build options : each setting
+// compiles to its own variant, with no branch or argument for it at runtime
+// CHANNEL : 0 red, 1 green, 2 blue, 3 alpha, 4 luma (Rec. 601), 5 HSV value
+#ifndef THRESHOLD
+#define THRESHOLD 0.5f
+#endif
+#ifndef CHANNEL
+#define CHANNEL 0
+#endif
+#ifndef INVERT
+#define INVERT 0
+#endif
+
+float channel_value(float4 color)
+{
+#if CHANNEL == 1
+  return color.y;
+#elif CHANNEL == 2
+  return color.z;
+#elif CHANNEL == 3
+  return color.w;
+#elif CHANNEL == 4
+  return 0.299f*color.x + 0.587f*color.y + 0.114f*color.z;
+#elif CHANNEL == 5
+  return max(max(color.x, color.y), color.z);
+#else
+  return color.x;
+#endif
+}
+
+bool apply_invert(bool set)
+{
+#if INVERT
+  return !set;
+#else
+  return set;
+#endif
+}
+
+// adaptive thresholds (ADAPTIVE 1 : Otsu, 2 : local mean), background
+// subtraction (3 : running average, 4 : running gaussian) and morphology
+// (MORPH 1 : erode, 2 : dilate, 3 : open, 4 : close) : mask_kernel
+// classifies the pixels and cleans up the mask into an image, which the
+// output kernels then read in place of the texture, with roi (0, 0, 1)
+#ifndef ADAPTIVE
+#define ADAPTIVE 0
+#endif
+#ifndef MORPH
+#define MORPH 0
+#endif
+#define MASK_PASS ( ADAPTIVE || MORPH )
+
+bool classify(float4 color)
+{
+#if MASK_PASS
+  return color.x > 0.5f;
+#else
+  return apply_invert(channel_value(color) > THRESHOLD);
+#endif
+}
+
+// region of interest and decimation : pixel (i, j) of the w x h mask
+// is texture pixel (roi.x + i*roi.z, roi.y + j*roi.z)
+float4 read_roi(__read_only image2d_t im, int4 roi, int i, int j)
+{
+  int2 coord = { roi.x + i*roi.z, roi.y + j*roi.z };
+  return read_imagef( im, srcSampler, coord);
+}
+
+// the global range is padded to a multiple of the work-group size :
+// work items outside of the mask return right away
+
+// one work item per pixel : writes GL_LUMINANCE bytes (0 or 255)
+__kernel void process_texture_kernel(__read_only image2d_t im, __global uchar *dst, int w, int h, int4 roi)
+{
 	int i = get_global_id(0);
   int j = get_global_id(1);
+  if ( i >= w || j >= h ) return;
+  float4 color = read_roi(im, roi, i, j);
+  int idx = i+w*j;
+	dst[idx]= classify(color) ? 255 : 0;
+}
+
+// one work item per pixel, into a GL texture : white where the mask is set.
+// RGBA8, the one format every GL sharing implementation can write to
+__kernel void image_texture_kernel(__read_only image2d_t im, __write_only image2d_t dst, int w, int h, int4 roi)
+{
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  if ( i >= w || j >= h ) return;
+  float v = classify(read_roi(im, roi, i, j)) ? 1.f : 0.f;
   int2 coord = { i, j };
-  float4 color = read_imagef( im, srcSampler, coord);
+  write_imagef(dst, coord, (float4)(v, v, v, 1.f));
+}
+
+// one work item per 32 pixels of a row : bit b of word i holds pixel i*32+b
+// rows are padded to (w+31)/32 words
+__kernel void pack_texture_kernel(__read_only image2d_t im, __global uint *dst, int w, int h, int4 roi)
+{
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  int words = (w+31)/32;
+  if ( i >= words || j >= h ) return;
+  uint word = 0;
+  for ( int b = 0; b < 32; b++ ){
+    int x = i*32+b;
+    if ( x < w ){
+      float4 color = read_roi(im, roi, x, j);
+      word |= (uint)classify(color) << b;
+    }
+  }
+  dst[i+words*j] = word;
+}
+
+// statistics of the mask : a reduction per work-group, then one
+// work-group reduces the partial results, only STATS_VALUES ulongs are read back.
+// integer sums are exact, even for the second moments of a 4K frame
+#ifndef STATS_GROUP_SIZE
+#define STATS_GROUP_SIZE 64
+#endif
+// count, sum x, sum y, sum xx, sum yy, sum xy, min x, min y, max x, max y
+#define STATS_VALUES 10
+
+#define STATS_INIT(v) { \
+  for ( int n = 0; n < 6; n++ ) (v)[n] = 0; \
+  (v)[6] = (v)[7] = 0xFFFFFFFF; \
+  (v)[8] = (v)[9] = 0; }
+
+#define STATS_MERGE(a, b) { \
+  for ( int n = 0; n < 6; n++ ) (a)[n] += (b)[n]; \
+  (a)[6] = min((a)[6], (b)[6]); (a)[7] = min((a)[7], (b)[7]); \
+  (a)[8] = max((a)[8], (b)[8]); (a)[9] = max((a)[9], (b)[9]); }
+
+// tree reduction of s[0..STATS_GROUP_SIZE*STATS_VALUES) into s[0..STATS_VALUES)
+void stats_reduce_local(__local ulong *s)
+{
+  int l = get_local_id(0);
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for ( int stride = STATS_GROUP_SIZE/2; stride > 0; stride >>= 1 ){
+    if ( l < stride ) STATS_MERGE(s + l*STATS_VALUES, s + (l+stride)*STATS_VALUES);
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+}
+
+// one work item per 32 pixels of a row, as in pack_texture_kernel,
+// flattened to 1D : work item k handles row k/words
+__kernel __attribute__((reqd_work_group_size(STATS_GROUP_SIZE, 1, 1)))
+void stats_texture_kernel(__read_only image2d_t im, __global ulong *partial, int w, int h, int4 roi)
+{
+  __local ulong s[STATS_GROUP_SIZE * STATS_VALUES];
+  int words = (w+31)/32;
+  int k = get_global_id(0);
+  int l = get_local_id(0);
+  ulong v[STATS_VALUES];
+  STATS_INIT(v);
+
+  if ( k < words*h ){
+    int j = k / words;
+    int x0 = (k - j*words) * 32;
+    for ( int b = 0; b < 32; b++ ){
+      int x = x0+b;
+      if ( x >= w ) break;
+      if ( !classify(read_roi(im, roi, x, j)) ) continue;
+      v[0]++;
+      v[1] += x;
+      v[2] += j;
+      v[3] += (ulong)x*x;
+      v[4] += (ulong)j*j;
+      v[5] += (ulong)x*j;
+      v[6] = min(v[6], (ulong)x);
+      v[7] = min(v[7], (ulong)j);
+      v[8] = max(v[8], (ulong)x);
+      v[9] = max(v[9], (ulong)j);
+    }
+  }
+
+  for ( int n = 0; n < STATS_VALUES; n++ ) s[l*STATS_VALUES + n] = v[n];
+  stats_reduce_local(s);
+  if ( l < STATS_VALUES ) partial[get_group_id(0)*STATS_VALUES + l] = s[l];
+}
+
+// a single work-group : reduces the partial results of 'groups' work-groups
+__kernel __attribute__((reqd_work_group_size(STATS_GROUP_SIZE, 1, 1)))
+void stats_reduce_kernel(__global const ulong *partial, int groups, __global ulong *result)
+{
+  __local ulong s[STATS_GROUP_SIZE * STATS_VALUES];
+  int l = get_local_id(0);
+  ulong v[STATS_VALUES];
+  STATS_INIT(v);
+
+  for ( int g = l; g < groups; g += STATS_GROUP_SIZE ) STATS_MERGE(v, partial + g*STATS_VALUES);
+
+  for ( int n = 0; n < STATS_VALUES; n++ ) s[l*STATS_VALUES + n] = v[n];
+  stats_reduce_local(s);
+  if ( l < STATS_VALUES ) result[l] = s[l];
+}
+
+// connected components of the mask (8-connectivity), by union-find :
+// labels hold the index of a parent pixel, -1 for the background.
+// ccl_init, ccl_merge and ccl_compress leave every pixel pointing to the
+// root of its component, ccl_area counts the pixels of each root,
+// ccl_roots numbers the roots of 'minArea' pixels or more and drops the
+// others, and blob_accumulate sums up area, centroid and bounding box of
+// the first 'maxLabels' ones into a table : [count] followed by
+// BLOB_VALUES uints per label
+// area, sum x (lo, hi), sum y (lo, hi), min x, min y, max x, max y
+#define BLOB_VALUES 9
+
+int ccl_find(__global volatile int *labels, int x)
+{
+  int p = labels[x];
+  while ( p != x ){
+    x = p;
+    p = labels[x];
+  }
+  return x;
+}
+
+// hook the larger root below the smaller one, until both have the same root
+void ccl_unite(__global volatile int *labels, int a, int b)
+{
+  bool done = false;
+  while ( !done ){
+    a = ccl_find(labels, a);
+    b = ccl_find(labels, b);
+    if ( a < b ){
+      int old = atomic_min(&labels[b], a);
+      done = ( old == b );
+      b = old;
+    } else if ( b < a ){
+      int old = atomic_min(&labels[a], b);
+      done = ( old == a );
+      a = old;
+    } else {
+      done = true;
+    }
+  }
+}
+
+// 64 bit sum out of two 32 bit atomics (no int64 atomics needed)
+void blob_add64(__global uint *sum, uint value)
+{
+  uint old = atomic_add(&sum[0], value);
+  if ( old + value < old ) atomic_inc(&sum[1]);
+}
+
+__kernel void ccl_init_kernel(__read_only image2d_t im, __global int *labels, int w, int h, int4 roi)
+{
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  if ( i >= w || j >= h ) return;
+  labels[i+w*j] = classify(read_roi(im, roi, i, j)) ? i+w*j : -1;
+}
+
+__kernel void ccl_merge_kernel(__global volatile int *labels, int w, int h)
+{
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  if ( i >= w || j >= h ) return;
   int idx = i+w*j;
-	dst[idx]= color.x > 0.5;
+  if ( labels[idx] < 0 ) return;
+
+  if ( i > 0 && labels[idx-1] >= 0 ) ccl_unite(labels, idx, idx-1);
+  if ( j > 0 ){
+    int up = idx-w;
+    if ( i > 0 && labels[up-1] >= 0 ) ccl_unite(labels, idx, up-1);
+    if ( labels[up] >= 0 ) ccl_unite(labels, idx, up);
+    if ( i < w-1 && labels[up+1] >= 0 ) ccl_unite(labels, idx, up+1);
+  }
+}
+
+// also clears the area counters for ccl_area
+__kernel void ccl_compress_kernel(__global volatile int *labels, __global uint *areas, int w, int h)
+{
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  if ( i >= w || j >= h ) return;
+  int idx = i+w*j;
+  if ( labels[idx] >= 0 ) labels[idx] = ccl_find(labels, idx);
+  areas[idx] = 0;
+}
+
+__kernel void ccl_area_kernel(__global const int *labels, __global uint *areas, int w, int h)
+{
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  if ( i >= w || j >= h ) return;
+  int root = labels[i+w*j];
+  if ( root >= 0 ) atomic_inc(&areas[root]);
+}
+
+__kernel void blob_clear_kernel(__global uint *table, int size)
+{
+  int i = get_global_id(0);
+  if ( i >= size ) return;
+  int v = (i-1) % BLOB_VALUES;
+  // min x/y start at the maximum
+  table[i] = ( i > 0 && ( v == 5 || v == 6 ) ) ? 0xFFFFFFFF : 0;
+}
+
+// roots get a compact id, stored as -(id+2) in their label. roots of
+// smaller components become background (-1) : they take no room in the table
+__kernel void ccl_roots_kernel(__global int *labels, __global const uint *areas, __global uint *table,
+                               int w, int h, int minArea)
+{
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  if ( i >= w || j >= h ) return;
+  int idx = i+w*j;
+  if ( labels[idx] != idx ) return;
+  labels[idx] = areas[idx] >= (uint)minArea ? -(int)atomic_inc(&table[0]) - 2 : -1;
+}
+
+__kernel void blob_accumulate_kernel(__global const int *labels, __global uint *table, int w, int h, int maxLabels)
+{
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  if ( i >= w || j >= h ) return;
+  int root = labels[i+w*j];
+  if ( root == -1 ) return;
+  int id = -( root < 0 ? root : labels[root] ) - 2;
+  // dropped component, or no room left in the table
+  if ( id < 0 || id >= maxLabels ) return;
+
+  __global uint *blob = table + 1 + id*BLOB_VALUES;
+  atomic_inc(&blob[0]);
+  blob_add64(blob+1, i);
+  blob_add64(blob+3, j);
+  atomic_min(&blob[5], (uint)i);
+  atomic_min(&blob[6], (uint)j);
+  atomic_max(&blob[7], (uint)i);
+  atomic_max(&blob[8], (uint)j);
+}
+
+// coordinates of the mask pixels, appended to a list : points[0] counts
+// all of them, the first maxPoints are stored as x | y<<16 from points[1] on.
+// each work-group reserves its range with a single global atomic.
+// the order of the points is not deterministic
+__kernel void points_texture_kernel(__read_only image2d_t im, __global uint *points, int w, int h, int4 roi, int maxPoints)
+{
+  __local uint groupCount, groupBase;
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  int l = get_local_id(0) + get_local_size(0)*get_local_id(1);
+
+  // no early return : every work item has to reach the barriers
+  bool set = false;
+  if ( i < w && j < h ) set = classify(read_roi(im, roi, i, j));
+
+  if ( l == 0 ) groupCount = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  uint slot = set ? atomic_inc(&groupCount) : 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if ( l == 0 ) groupBase = groupCount ? atomic_add(&points[0], groupCount) : 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  uint k = groupBase + slot;
+  if ( set && k < (uint)maxPoints ) points[1+k] = (uint)i | ((uint)j << 16);
+}
+
+// Otsu : a histogram of the channel, built with local atomics and merged
+// with one global atomic per bin and work-group, then a single work-group
+// picks the level that maximizes the between-class variance.
+// the level stays on the device, in hist[HIST_BINS]
+#define HIST_BINS 256
+
+int hist_bin(float value)
+{
+  return clamp((int)(value * HIST_BINS), 0, HIST_BINS-1);
+}
+
+__kernel void histogram_kernel(__read_only image2d_t im, __global uint *hist, int w, int h, int4 roi)
+{
+  __local uint bins[HIST_BINS];
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  int l = get_local_id(0) + get_local_size(0)*get_local_id(1);
+  int n = get_local_size(0)*get_local_size(1);
+
+  for ( int k = l; k < HIST_BINS; k += n ) bins[k] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+  if ( i < w && j < h ) atomic_inc(&bins[hist_bin(channel_value(read_roi(im, roi, i, j)))]);
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for ( int k = l; k < HIST_BINS; k += n )
+    if ( bins[k] ) atomic_add(&hist[k], bins[k]);
+}
+
+// one work item per level : the pixels above level t are the foreground.
+// also clears the histogram for the next frame
+__kernel __attribute__((reqd_work_group_size(HIST_BINS, 1, 1)))
+void otsu_kernel(__global uint *hist)
+{
+  __local ulong count[HIST_BINS], sum[HIST_BINS];
+  __local float score[HIST_BINS];
+  __local int best[HIST_BINS];
+  int t = get_local_id(0);
+
+  count[t] = hist[t];
+  sum[t] = (ulong)hist[t] * t;
+  hist[t] = 0;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // inclusive prefix sums : count and sum of the levels up to t
+  for ( int offset = 1; offset < HIST_BINS; offset <<= 1 ){
+    ulong c = t >= offset ? count[t-offset] : 0;
+    ulong s = t >= offset ? sum[t-offset] : 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    count[t] += c;
+    sum[t] += s;
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+
+  // between-class variance, up to a constant factor
+  float w0 = count[t];
+  float w1 = count[HIST_BINS-1] - count[t];
+  float v = 0.f;
+  if ( w0 > 0.f && w1 > 0.f ){
+    float d = sum[t] / w0 - (sum[HIST_BINS-1] - sum[t]) / w1;
+    v = w0 * w1 * d * d;
+  }
+  score[t] = v;
+  best[t] = t;
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+  // arg max, the lowest level on ties
+  for ( int stride = HIST_BINS/2; stride > 0; stride >>= 1 ){
+    if ( t < stride && score[t+stride] > score[t] ){
+      score[t] = score[t+stride];
+      best[t] = best[t+stride];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+  }
+  if ( t == 0 ) hist[HIST_BINS] = best[0];
+}
+
+// the mask pass, one launch : each work-group classifies its MASK_TILE^2
+// tile and the halo the morphology needs into local memory, then erodes
+// and / or dilates it there, and writes the tile only.
+// the local mean needs the channel values of another MEAN_RADIUS around
+// that, summed up separably (rows, then columns).
+// the mask is extended past its borders by repeating the edge pixels
+#ifndef MEAN_RADIUS
+#define MEAN_RADIUS 7
+#endif
+#ifndef MEAN_OFFSET
+#define MEAN_OFFSET 0.02f
+#endif
+#ifndef MORPH_RADIUS
+#define MORPH_RADIUS 1
+#endif
+#define MASK_TILE 16
+
+#if MORPH == 1 || MORPH == 2
+#define MORPH_HALO MORPH_RADIUS
+#elif MORPH == 3 || MORPH == 4
+#define MORPH_HALO (2*MORPH_RADIUS)
+#else
+#define MORPH_HALO 0
+#endif
+#define MASK_SPAN (MASK_TILE + 2*MORPH_HALO)
+#define VALUE_SPAN (MASK_SPAN + 2*MEAN_RADIUS)
+
+// background model : running mean and variance of the channel, two
+// floats per pixel of the mask, the mean is negative until the first frame.
+// the average (3) takes differences above THRESHOLD as foreground,
+// the gaussian (4) those above BG_K standard deviations.
+// BG_ALPHA 1 is frame differencing
+#ifndef BG_ALPHA
+#define BG_ALPHA 0.05f
+#endif
+#ifndef BG_K
+#define BG_K 2.5f
+#endif
+// variance of a new model, and the floor that keeps noise out of a still one
+#define BG_VAR_INIT 0.01f
+#define BG_VAR_MIN 0.0001f
+
+bool bg_foreground(float value, __global const float *model)
+{
+  if ( model[0] < 0.f ) return false;
+  float d = value - model[0];
+#if ADAPTIVE == 4
+  return d*d > BG_K*BG_K * max(model[1], BG_VAR_MIN);
+#else
+  return fabs(d) > THRESHOLD;
+#endif
+}
+
+void bg_update(float value, __global const float *in, __global float *out)
+{
+  if ( in[0] < 0.f ){
+    out[0] = value;
+    out[1] = BG_VAR_INIT;
+    return;
+  }
+  float d = value - in[0];
+  out[0] = in[0] + BG_ALPHA*d;
+  out[1] = in[1] + BG_ALPHA*(d*d - in[1]);
+}
+
+// min (erode) or max (dilate) over a square of side 2*MORPH_RADIUS+1 :
+// dst is span x span, src is (span + 2*MORPH_RADIUS)^2, both with row stride MASK_SPAN
+void morph_local(__local const uchar *src, __local uchar *dst, int span, bool dilate)
+{
+  for ( int y = get_local_id(1); y < span; y += MASK_TILE ){
+    for ( int x = get_local_id(0); x < span; x += MASK_TILE ){
+      uchar v = src[y*MASK_SPAN + x];
+      for ( int dy = 0; dy <= 2*MORPH_RADIUS; dy++ )
+        for ( int dx = 0; dx <= 2*MORPH_RADIUS; dx++ ){
+          uchar n = src[(y+dy)*MASK_SPAN + x+dx];
+          v = dilate ? max(v, n) : min(v, n);
+        }
+      dst[y*MASK_SPAN + x] = v;
+    }
+  }
+  barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+__kernel __attribute__((reqd_work_group_size(MASK_TILE, MASK_TILE, 1)))
+void mask_kernel(__read_only image2d_t im, __write_only image2d_t mask, int w, int h, int4 roi,
+                 __global const uint *hist, __global const float *modelIn, __global float *modelOut)
+{
+  __local uchar bits[MASK_SPAN * MASK_SPAN];
+  int lx = get_local_id(0);
+  int ly = get_local_id(1);
+  // texture pixel of bits[0]
+  int x0 = get_group_id(0)*MASK_TILE - MORPH_HALO;
+  int y0 = get_group_id(1)*MASK_TILE - MORPH_HALO;
+
+#if ADAPTIVE == 2
+  __local float values[VALUE_SPAN][VALUE_SPAN];
+  __local float rows[VALUE_SPAN][MASK_SPAN];
+  for ( int y = ly; y < VALUE_SPAN; y += MASK_TILE )
+    for ( int x = lx; x < VALUE_SPAN; x += MASK_TILE )
+      values[y][x] = channel_value(read_roi(im, roi,
+                                            clamp(x0-MEAN_RADIUS+x, 0, w-1),
+                                            clamp(y0-MEAN_RADIUS+y, 0, h-1)));
+  barrier(CLK_LOCAL_MEM_FENCE);
+  for ( int y = ly; y < VALUE_SPAN; y += MASK_TILE )
+    for ( int x = lx; x < MASK_SPAN; x += MASK_TILE ){
+      float s = 0.f;
+      for ( int k = 0; k <= 2*MEAN_RADIUS; k++ ) s += values[y][x+k];
+      rows[y][x] = s;
+    }
+  barrier(CLK_LOCAL_MEM_FENCE);
+#elif ADAPTIVE == 1
+  int level = hist[HIST_BINS];
+#endif
+
+  for ( int y = ly; y < MASK_SPAN; y += MASK_TILE ){
+    for ( int x = lx; x < MASK_SPAN; x += MASK_TILE ){
+#if ADAPTIVE == 2
+      float s = 0.f;
+      for ( int k = 0; k <= 2*MEAN_RADIUS; k++ ) s += rows[y+k][x];
+      float mean = s / ((2*MEAN_RADIUS+1) * (2*MEAN_RADIUS+1));
+      bool set = values[y+MEAN_RADIUS][x+MEAN_RADIUS] > mean - MEAN_OFFSET;
+#else
+      int px = clamp(x0+x, 0, w-1);
+      int py = clamp(y0+y, 0, h-1);
+      float value = channel_value(read_roi(im, roi, px, py));
+#if ADAPTIVE == 1
+      bool set = hist_bin(value) > level;
+#elif ADAPTIVE == 3 || ADAPTIVE == 4
+      int m = 2*(px + w*py);
+      bool set = bg_foreground(value, modelIn + m);
+#else
+      bool set = value > THRESHOLD;
+#endif
+#endif
+      bits[y*MASK_SPAN + x] = apply_invert(set);
+    }
+  }
+
+#if ADAPTIVE == 3 || ADAPTIVE == 4
+  // each work-item updates the model of its own pixel, into the other
+  // buffer : the halos of the neighbouring tiles still read this frame's
+  {
+    int i = get_global_id(0);
+    int j = get_global_id(1);
+    if ( i < w && j < h ){
+      int m = 2*(i + w*j);
+      bg_update(channel_value(read_roi(im, roi, i, j)), modelIn + m, modelOut + m);
+    }
+  }
+#endif
+  barrier(CLK_LOCAL_MEM_FENCE);
+
+#if MORPH
+  __local uchar tmp[MASK_SPAN * MASK_SPAN];
+#endif
+#if MORPH == 1 || MORPH == 2
+  morph_local(bits, tmp, MASK_TILE, MORPH == 2);
+  bool result = tmp[ly*MASK_SPAN + lx];
+#elif MORPH == 3 || MORPH == 4
+  // open : erode, then dilate ; close : the other way round
+  morph_local(bits, tmp, MASK_TILE + 2*MORPH_RADIUS, MORPH == 4);
+  morph_local(tmp, bits, MASK_TILE, MORPH == 3);
+  bool result = bits[ly*MASK_SPAN + lx];
+#else
+  bool result = bits[ly*MASK_SPAN + lx];
+#endif
+
+  int i = get_global_id(0);
+  int j = get_global_id(1);
+  if ( i >= w || j >= h ) return;
+  int2 coord = { i, j };
+  write_imagef(mask, coord, (float4)(result ? 1.f : 0.f));
 }
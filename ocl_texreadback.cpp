@@ -16,8 +16,27 @@
 
 #include "ocl_texreadback.hpp"
 
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#include <sys/stat.h>
+#include <algorithm>
+#include <iomanip>
+
 CPPEXTERN_NEW_WITH_ONE_ARG(ocl_texreadback, t_floatarg, A_DEFFLOAT);
 
+static const char *s_outputNames[] = { "bytes", "packed", "stats", "blobs", "points", "texture" };
+static const char *s_inputNames[] = { "texture", "host" };
+// CHANNEL in the kernels
+static const char *s_channelNames[] = { "r", "g", "b", "a", "luma", "value" };
+static const int s_numChannels = sizeof(s_channelNames) / sizeof(s_channelNames[0]);
+// ADAPTIVE in the kernels
+static const char *s_adaptiveNames[] = { "off", "otsu", "mean", "average", "gaussian" };
+// MORPH in the kernels
+static const char *s_morphNames[] = { "none", "erode", "dilate", "open", "close" };
+
 /// 
 // Demonstrate usage of the GL Object querying capabilities
 //
@@ -53,263 +72,922 @@ void ocl_texreadback :: performQueries() {
 }
 
 ///
-//  Create an OpenCL context on the first available platform using
-//  either a GPU or CPU depending on what is available.
+//  Check whether the GL -> CL handoff can use sync objects
+//  (GL_ARB_sync on the GL side, cl_khr_gl_event on the CL side)
 //
-cl_context ocl_texreadback :: CreateContext()
+void ocl_texreadback :: queryGLSync() {
+  m_createEventFromGLsync = NULL;
+
+  if ( !m_runtime->hasExtension("cl_khr_gl_event") || !GLEW_ARB_sync ){
+    post("GL/CL sync objects not available, using glFinish()");
+    return;
+  }
+  m_createEventFromGLsync = (ocl_clCreateEventFromGLsyncKHR_fn)
+    clGetExtensionFunctionAddress("clCreateEventFromGLsyncKHR");
+}
+
+///
+//  Create memory objects used as the arguments to kernels in OpenCL
+//  The memory objects are created from existing OpenGL buffers and textures
+//
+bool ocl_texreadback :: CreateMemObjects(cl_context context, GLuint texture, cl_mem *p_cl_tex_mem)
 {
-    cl_int errNum;
-    cl_uint numPlatforms;
-    cl_platform_id firstPlatformId;
-    cl_context context = NULL;
-
-    // First, select an OpenCL platform to run on.  For this example, we
-    // simply choose the first available platform.  Normally, you would
-    // query for all available platforms and select the most appropriate one.
-    errNum = clGetPlatformIDs(1, &firstPlatformId, &numPlatforms);
-    if (errNum != CL_SUCCESS || numPlatforms <= 0)
+	cl_int errNum;
+	
+	// host : the pix data is wrapped once it is there, see wrapPix()
+	if ( m_input == INPUT_HOST )
+	  return CreateResultBuffers();
+
+	*p_cl_tex_mem = clCreateFromGLTexture2D(context, CL_MEM_READ_ONLY, GL_TEXTURE_RECTANGLE_ARB, 0, texture, &errNum );
+	if( errNum != CL_SUCCESS )
+	{
+		std::cerr<< "Failed creating memory from GL texture." << std::endl;
+		return false;
+	}
+  
+  return CreateResultBuffers();
+}
+
+///
+//  Create the ring of result buffers for the current output mode
+//
+bool ocl_texreadback :: CreateResultBuffers()
+{
+  // texture : the result stays on the device, see CreateOutputTexture()
+  for ( int i = 0; m_output != OUTPUT_TEXTURE && i < OCL_RING_SIZE; i++ ){
+    // pinned host memory : the result is mapped rather than copied
+    m_ring[i].mem = m_pool.get(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, binBufSize());
+    if ( m_ring[i].mem == NULL )
     {
-        std::cerr << "Failed to find any OpenCL platforms." << std::endl;
-        return NULL;
+      std::cerr << "Error creating memory objects." << std::endl;
+      return false;
     }
-
-    // Next, create an OpenCL context on the platform.  Attempt to
-    // create a GPU-based context, and if that fails, try to create
-    // a CPU-based context.
-    cl_context_properties contextProperties[] =
+  }
+  if ( m_output == OUTPUT_STATS ){
+    m_partialMem = m_pool.get(context, CL_MEM_READ_WRITE, statsGroups() * OCL_STATS_VALUES * sizeof(cl_ulong));
+    if ( m_partialMem == NULL )
     {
-#ifdef _WIN32
-        CL_CONTEXT_PLATFORM,
-        (cl_context_properties)firstPlatformId,
-		CL_GL_CONTEXT_KHR,
-		(cl_context_properties)wglGetCurrentContext(),
-		CL_WGL_HDC_KHR,
-		(cl_context_properties)wglGetCurrentDC(),
-#elif defined( __GNUC__)
-		CL_CONTEXT_PLATFORM, (cl_context_properties)firstPlatformId, 
-		CL_GL_CONTEXT_KHR, (cl_context_properties)glXGetCurrentContext(), 
-		CL_GLX_DISPLAY_KHR, (cl_context_properties)glXGetCurrentDisplay(), 
-#elif defined(__APPLE__) 
-		//todo
-#endif
-        0
-
-
+      std::cerr << "Error creating memory objects." << std::endl;
+      return false;
+    }
+  }
+  if ( m_output == OUTPUT_BLOBS ){
+    m_labelMem = m_pool.get(context, CL_MEM_READ_WRITE, sizeof(cl_int) * m_width * m_height);
+    m_areaMem = m_pool.get(context, CL_MEM_READ_WRITE, sizeof(cl_uint) * m_width * m_height);
+    if ( m_labelMem == NULL || m_areaMem == NULL )
+    {
+      std::cerr << "Error creating memory objects." << std::endl;
+      return false;
+    }
+  }
+  m_ringIndex = 0;
+  return true;
+}
 
-    };
-	cl_uint uiDevCount;
-    cl_device_id* cdDevices;
-	// Get the number of GPU devices available to the platform
-    errNum = clGetDeviceIDs(firstPlatformId, CL_DEVICE_TYPE_GPU, 0, NULL, &uiDevCount);
+///
+//  The frame size has changed : the GL texture has been respecified,
+//  and the result buffers of the old size go back to the pool
+//
+bool ocl_texreadback :: ResizeMemObjects()
+{
+  ReleaseResultBuffers();
+  if ( cl_tex_mem ){
+    clReleaseMemObject(cl_tex_mem);
+    cl_tex_mem = 0;
+  }
+  return CreateMemObjects(context, texture, &cl_tex_mem);
+}
 
-    // Create the device list
-    cdDevices = new cl_device_id [uiDevCount];
-    errNum = clGetDeviceIDs(firstPlatformId, CL_DEVICE_TYPE_GPU, uiDevCount, cdDevices, NULL);
+///
+//  Wait for pending readbacks and give the result buffers back to the pool
+//
+void ocl_texreadback :: ReleaseResultBuffers()
+{
+  for ( int i = 0; i < OCL_RING_SIZE; i++ ){
+    unmapResult(i);
+  }
+  if ( commandQueue ) clFinish(commandQueue);
+  for ( int i = 0; i < OCL_RING_SIZE; i++ ){
+    m_pool.put(m_ring[i].mem);
+    m_ring[i].mem = 0;
+  }
+  m_pool.put(m_partialMem);
+  m_partialMem = 0;
+  m_pool.put(m_labelMem);
+  m_labelMem = 0;
+  m_pool.put(m_areaMem);
+  m_areaMem = 0;
+  m_pool.put(m_histMem);
+  m_histMem = 0;
+  for ( int i = 0; i < 2; i++ ){
+    m_pool.put(m_modelMem[i]);
+    m_modelMem[i] = 0;
+  }
+  if ( m_maskMem ){
+    clReleaseMemObject(m_maskMem);
+    m_maskMem = 0;
+  }
+  if ( m_outTexMem ){
+    clReleaseMemObject(m_outTexMem);
+    m_outTexMem = 0;
+  }
+  if ( m_releaseEvent ){
+    clReleaseEvent(m_releaseEvent);
+    m_releaseEvent = 0;
+  }
+  m_pixBlock.image.data = NULL;
+}
 
+///
+//  Size in bytes of the result buffer for the current output mode
+//
+size_t ocl_texreadback :: binBufSize()
+{
+  switch ( m_output ){
+  case OUTPUT_PACKED:
+    return sizeof(cl_uint) * ((m_width+31)/32) * m_height;
+  case OUTPUT_STATS:
+    return sizeof(cl_ulong) * OCL_STATS_VALUES;
+  case OUTPUT_BLOBS:
+    return sizeof(cl_uint) * (1 + OCL_BLOB_LABELS * OCL_BLOB_VALUES);
+  case OUTPUT_POINTS:
+    return sizeof(cl_uint) * (1 + m_maxPoints);
+  default:
+    return sizeof(cl_uchar) * m_width * m_height;
+  }
+}
 
-    context = clCreateContext(contextProperties, 1, &cdDevices[0], NULL, NULL, &errNum);
-	//// alternate:
-    //context = clCreateContextFromType(contextProperties, CL_DEVICE_TYPE_GPU,
-    //                                  NULL, NULL, &errNum);
+///
+//  Number of work-groups of the statistics kernel
+//  (one work item per 32 pixels of a row)
+//
+size_t ocl_texreadback :: statsGroups()
+{
+  size_t items = (size_t)((m_width+31)/32) * m_height;
+  return (items + OCL_STATS_GROUP_SIZE - 1) / OCL_STATS_GROUP_SIZE;
+}
 
-    if (errNum != CL_SUCCESS)
-    {
-        std::cout << "Could not create GPU context, trying CPU..." << std::endl;
-        context = clCreateContextFromType(contextProperties, CL_DEVICE_TYPE_CPU,
-                                          NULL, NULL, &errNum);
-        if (errNum != CL_SUCCESS)
-        {
-            std::cerr << "Failed to create an OpenCL GPU or CPU context." << std::endl;
-            return NULL;
-        }
-    }
+cl_kernel ocl_texreadback :: outputKernel()
+{
+  switch ( m_output ){
+  case OUTPUT_PACKED: return pack_kernel;
+  case OUTPUT_STATS:  return stats_kernel;
+  case OUTPUT_BLOBS:  return ccl_init_kernel;
+  case OUTPUT_POINTS: return points_kernel;
+  case OUTPUT_TEXTURE: return image_kernel;
+  default:            return tex_kernel;
+  }
+}
 
-    return context;
+///
+//  Give a result buffer back to the device before it gets written again
+//
+void ocl_texreadback :: unmapResult(int slot)
+{
+  resultSlot &r = m_ring[slot];
+  if ( r.ready ){
+    clReleaseEvent(r.ready);
+    r.ready = 0;
+  }
+  for ( int i = 0; i < 4; i++ ){
+    if ( r.prof[i] ) clReleaseEvent(r.prof[i]);
+    r.prof[i] = 0;
+  }
+  if ( r.ptr && r.mem ){
+    clEnqueueUnmapMemObject(commandQueue, r.mem, r.ptr, 0, NULL, NULL);
+  }
+  r.ptr = NULL;
 }
 
 ///
-//  Create a command queue on the first device available on the
-//  context
+//  Cleanup any created OpenCL resources
 //
-cl_command_queue ocl_texreadback :: CreateCommandQueue(cl_context context, cl_device_id *device)
+void ocl_texreadback :: Cleanup()
 {
-    cl_int errNum;
-    cl_device_id *devices;
-    cl_command_queue commandQueue = NULL;
-    size_t deviceBufferSize = -1;
+    ReleaseResultBuffers();
+    m_pool.clear();
 
-    // First get the size of the devices buffer
-    errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, 0, NULL, &deviceBufferSize);
-    if (errNum != CL_SUCCESS)
-    {
-        std::cerr << "Failed call to clGetContextInfo(...,GL_CONTEXT_DEVICES,...)";
-        return NULL;
+    if ( m_fence ){
+        glDeleteSync(m_fence);
+        m_fence = 0;
     }
 
-    if (deviceBufferSize <= 0)
-    {
-        std::cerr << "No devices available.";
-        return NULL;
+    if( cl_tex_mem != 0 ){
+      clReleaseMemObject(cl_tex_mem);
+      cl_tex_mem=0;
     }
 
-    // Allocate memory for the devices buffer
-    devices = new cl_device_id[deviceBufferSize / sizeof(cl_device_id)];
-    errNum = clGetContextInfo(context, CL_CONTEXT_DEVICES, deviceBufferSize, devices, NULL);
-    if (errNum != CL_SUCCESS)
-    {
-        delete [] devices;
-        std::cerr << "Failed to get device IDs";
-        return NULL;
+    if ( m_build ){
+        m_runtime->cancelBuild(m_build);
+        m_build=NULL;
     }
 
-    // In this example, we just choose the first available device.  In a
-    // real program, you would likely use all available devices or choose
-    // the highest performance device based on OpenCL device queries
-    commandQueue = clCreateCommandQueue(context, devices[0], 0, NULL);
-    if (commandQueue == NULL)
-    {
-        delete [] devices;
-        std::cerr << "Failed to create commandQueue for device 0";
-        return NULL;
+    // kernels belong to the runtime's program cache
+    tex_kernel=0;
+    pack_kernel=0;
+    stats_kernel=0;
+    stats_reduce_kernel=0;
+    ccl_init_kernel=0;
+    ccl_merge_kernel=0;
+    ccl_compress_kernel=0;
+    ccl_area_kernel=0;
+    ccl_roots_kernel=0;
+    blob_clear_kernel=0;
+    blob_accumulate_kernel=0;
+    points_kernel=0;
+    image_kernel=0;
+    histogram_kernel=0;
+    otsu_kernel=0;
+    mask_kernel=0;
+
+    if (program != 0){
+        m_runtime->releaseProgram(program);
+        program=0;
+    }
+
+    if ( m_runtime ){
+        oclRuntime::release(m_runtime);
+        m_runtime=NULL;
     }
+    context=0;
+    commandQueue=0;
+    device=0;
+    m_opencl_is_init = false;
 
-    *device = devices[0];
-    delete [] devices;
-    return commandQueue;
+    post("Cleanup() complete");
 }
 
 ///
-//  Create an OpenCL program from the kernel source file
-//
-cl_program ocl_texreadback :: CreateProgram(cl_context context, cl_device_id device, const char* fileName)
+// Use OpenCL to process texture data
+cl_int ocl_texreadback :: computeTexture()
 {
-    cl_int errNum;
-    cl_program program;
+	cl_int errNum;
+	cl_kernel kernel = outputKernel();
+	resultSlot &r = m_ring[m_ringIndex];
 
-    std::ifstream kernelFile(fileName, std::ios::in);
-    if (!kernelFile.is_open())
+	unmapResult(m_ringIndex);
+	// per command timestamps, collected once the readback is done
+	cl_event *prof = m_profile ? r.prof : NULL;
+
+	if ( m_output == OUTPUT_TEXTURE && !m_outTexMem && !CreateOutputTexture() )
+	  return CL_INVALID_MEM_OBJECT;
+
+	// adaptive threshold or morphology : the output kernel reads the mask
+	// of the first pass. built for it, it would take the colours of the
+	// texture for a mask : no frame without the mask buffers
+	bool masked = ( m_programAdaptive != ADAPTIVE_OFF || m_programMorph != MORPH_NONE );
+	if ( masked && !CreateMaskBuffers() ){
+	  error("no mask buffers : frame skipped");
+	  return CL_MEM_OBJECT_ALLOCATION_FAILURE;
+	}
+	cl_int4 maskRoi;
+	maskRoi.s[0] = maskRoi.s[1] = maskRoi.s[3] = 0;
+	maskRoi.s[2] = 1;
+
+    errNum = clSetKernelArg(kernel, 0, sizeof(cl_mem), masked ? &m_maskMem : &cl_tex_mem);
+	// stats and blobs : intermediate results first
+	cl_mem *dst = &r.mem;
+	if ( m_output == OUTPUT_TEXTURE ) dst = &m_outTexMem;
+	if ( m_output == OUTPUT_STATS ) dst = &m_partialMem;
+	if ( m_output == OUTPUT_BLOBS ) dst = &m_labelMem;
+    errNum = clSetKernelArg(kernel, 1, sizeof(cl_mem), dst);
+    errNum = clSetKernelArg(kernel, 2, sizeof(cl_int), &m_width);
+    errNum = clSetKernelArg(kernel, 3, sizeof(cl_int), &m_height);
+    errNum = clSetKernelArg(kernel, 4, sizeof(cl_int4), masked ? &maskRoi : &m_roiArg);
+	if ( m_output == OUTPUT_POINTS )
+	  errNum = clSetKernelArg(kernel, 5, sizeof(cl_int), &m_maxPoints);
+	
+	// packed : one work item per 32 bits word
+	// stats : the same, flattened to 1D
+	size_t domain[2] = { (size_t)m_width, (size_t)m_height };
+	if ( m_output == OUTPUT_PACKED ) domain[0] = (m_width+31)/32;
+	if ( m_output == OUTPUT_STATS ){
+	  domain[0] = (size_t)((m_width+31)/32) * m_height;
+	  domain[1] = 1;
+	}
+	if ( !m_localSizeKnown[m_output] ) chooseLocalSize(kernel, domain);
+
+	if ( m_input == INPUT_HOST ) errNum = acquireHost(prof ? prof+0 : NULL);
+	else errNum = acquireTexture(prof ? prof+0 : NULL);
+	if ( masked && enqueueMask(prof ? prof+1 : NULL) != CL_SUCCESS )
+	  std::cerr << "Error queuing kernel for execution." << std::endl;
+
+	if ( m_tunePending ){
+	  // the texture is acquired and the arguments are set : time the candidates on it
+	  double ms;
+	  m_tunePending = false;
+	  if ( m_output == OUTPUT_STATS ){
+	    post("autotune: the statistics kernels have a fixed work-group size");
+	  } else if ( m_runtime->tuneLocalSize(kernel, domain, m_localSize[m_output], &ms) ){
+	    t_atom ap[4];
+	    SETSYMBOL(ap+0, gensym(s_outputNames[m_output]));
+	    SETFLOAT(ap+1, m_localSize[m_output][0]);
+	    SETFLOAT(ap+2, m_localSize[m_output][1]);
+	    SETFLOAT(ap+3, ms);
+	    outlet_anything(m_infoOut, gensym("autotune"), 4, ap);
+	  } else {
+	    error("autotune failed");
+	  }
+	}
+
+	if ( m_output == OUTPUT_POINTS ){
+	  // reset the counter only. after the tuning : its runs appended
+	  // points to the same buffer
+	  cl_int counter = 1;
+	  size_t one = 1;
+	  clSetKernelArg(blob_clear_kernel, 0, sizeof(cl_mem), &r.mem);
+	  clSetKernelArg(blob_clear_kernel, 1, sizeof(cl_int), &counter);
+	  clEnqueueNDRangeKernel(commandQueue, blob_clear_kernel, 1, NULL, &one, NULL, 0, NULL, NULL);
+	}
+
+	const size_t *local = m_localSize[m_output];
+	size_t global[2];
+	oclRuntime::globalSize(domain, local, global);
+
+	// the mask pass, if any, was the first kernel : this one is the last so far
+	cl_event *last = NULL;
+	if ( prof ) last = prof[1] ? prof+2 : prof+1;
+    errNum = clEnqueueNDRangeKernel(commandQueue, kernel, 2, NULL,
+                                    global, local[0] ? local : NULL,
+                                    0, NULL, last);
+	if ( prof && last == prof+1 ) last = prof+2;
+	if ( last && *last && ( m_output == OUTPUT_STATS || m_output == OUTPUT_BLOBS ) ){
+	  // the follow-up kernels end the frame
+	  clReleaseEvent(*last);
+	  *last = 0;
+	}
+    if (errNum != CL_SUCCESS)
     {
-        std::cerr << "Failed to open file for reading: " << fileName << std::endl;
-        return NULL;
+        std::cerr << "Error queuing kernel for execution." << std::endl;
     }
+	if ( m_output == OUTPUT_STATS ){
+	  // second pass, by a single work-group
+	  cl_int groups = statsGroups();
+	  size_t reduceSize = OCL_STATS_GROUP_SIZE;
+	  clSetKernelArg(stats_reduce_kernel, 0, sizeof(cl_mem), &m_partialMem);
+	  clSetKernelArg(stats_reduce_kernel, 1, sizeof(cl_int), &groups);
+	  clSetKernelArg(stats_reduce_kernel, 2, sizeof(cl_mem), &r.mem);
+	  errNum = clEnqueueNDRangeKernel(commandQueue, stats_reduce_kernel, 1, NULL,
+	                                  &reduceSize, &reduceSize, 0, NULL, last);
+	  if (errNum != CL_SUCCESS)
+	    std::cerr << "Error queuing kernel for execution." << std::endl;
+	}
+	if ( m_output == OUTPUT_BLOBS ){
+	  errNum = enqueueBlobs(r.mem, global, local[0] ? local : NULL, last);
+	  if (errNum != CL_SUCCESS)
+	    std::cerr << "Error queuing kernel for execution." << std::endl;
+	}
+	if ( m_releaseEvent ){
+	  clReleaseEvent(m_releaseEvent);
+	  m_releaseEvent = 0;
+	}
+	cl_mem objects[2];
+	if ( m_input == INPUT_HOST )
+	  // nothing to release : the marker tells when the kernels are done with the pix
+	  errNum = clEnqueueMarker(commandQueue, &m_releaseEvent);
+	else
+	  errNum = clEnqueueReleaseGLObjects(commandQueue, glObjects(objects), objects, 0, NULL, &m_releaseEvent );
+	if ( prof && m_releaseEvent ){
+	  clRetainEvent(m_releaseEvent);
+	  prof[3] = m_releaseEvent;
+	}
+	if ( m_output == OUTPUT_TEXTURE ){
+	  // GL reads the result where it is
+	  clFlush(commandQueue);
+	  return errNum;
+	}
 
-    std::ostringstream oss;
-    oss << kernelFile.rdbuf();
+	// non-blocking readback, completion is tracked by r.ready
+	r.ptr = (unsigned char*)clEnqueueMapBuffer(commandQueue, r.mem, CL_FALSE,
+                                 CL_MAP_READ, 0, binBufSize(),
+                                 0, NULL, &r.ready, &errNum);
+	if (errNum != CL_SUCCESS)
+	{
+	  r.ptr = NULL;
+	  r.ready = 0;
+	  std::cerr << "Error mapping result buffer." << std::endl;
+	}
+	clFlush(commandQueue);
+	return errNum;
+}
 
-    std::string srcStdStr = oss.str();
-    const char *srcStr = srcStdStr.c_str();
-    program = clCreateProgramWithSource(context, 1,
-                                        (const char**)&srcStr,
-                                        NULL, NULL);
-    if (program == NULL)
-    {
-        std::cerr << "Failed to create CL program from source." << std::endl;
-        return NULL;
+///
+// Label the components of the mask in m_labelMem and measure them into 'table'
+cl_int ocl_texreadback :: enqueueBlobs(cl_mem table, const size_t global[2], const size_t *local, cl_event *last)
+{
+  cl_int errNum = CL_SUCCESS;
+  cl_int maxLabels = OCL_BLOB_LABELS;
+  cl_int tableSize = 1 + OCL_BLOB_LABELS * OCL_BLOB_VALUES;
+  size_t clearSize = tableSize;
+
+  errNum |= clSetKernelArg(ccl_merge_kernel, 0, sizeof(cl_mem), &m_labelMem);
+  errNum |= clSetKernelArg(ccl_merge_kernel, 1, sizeof(cl_int), &m_width);
+  errNum |= clSetKernelArg(ccl_merge_kernel, 2, sizeof(cl_int), &m_height);
+  errNum |= clEnqueueNDRangeKernel(commandQueue, ccl_merge_kernel, 2, NULL, global, local, 0, NULL, NULL);
+
+  errNum |= clSetKernelArg(ccl_compress_kernel, 0, sizeof(cl_mem), &m_labelMem);
+  errNum |= clSetKernelArg(ccl_compress_kernel, 1, sizeof(cl_mem), &m_areaMem);
+  errNum |= clSetKernelArg(ccl_compress_kernel, 2, sizeof(cl_int), &m_width);
+  errNum |= clSetKernelArg(ccl_compress_kernel, 3, sizeof(cl_int), &m_height);
+  errNum |= clEnqueueNDRangeKernel(commandQueue, ccl_compress_kernel, 2, NULL, global, local, 0, NULL, NULL);
+
+  // small components are dropped before they get an id : only components
+  // of 'minarea' pixels or more compete for the table
+  errNum |= clSetKernelArg(ccl_area_kernel, 0, sizeof(cl_mem), &m_labelMem);
+  errNum |= clSetKernelArg(ccl_area_kernel, 1, sizeof(cl_mem), &m_areaMem);
+  errNum |= clSetKernelArg(ccl_area_kernel, 2, sizeof(cl_int), &m_width);
+  errNum |= clSetKernelArg(ccl_area_kernel, 3, sizeof(cl_int), &m_height);
+  errNum |= clEnqueueNDRangeKernel(commandQueue, ccl_area_kernel, 2, NULL, global, local, 0, NULL, NULL);
+
+  errNum |= clSetKernelArg(blob_clear_kernel, 0, sizeof(cl_mem), &table);
+  errNum |= clSetKernelArg(blob_clear_kernel, 1, sizeof(cl_int), &tableSize);
+  errNum |= clEnqueueNDRangeKernel(commandQueue, blob_clear_kernel, 1, NULL, &clearSize, NULL, 0, NULL, NULL);
+
+  errNum |= clSetKernelArg(ccl_roots_kernel, 0, sizeof(cl_mem), &m_labelMem);
+  errNum |= clSetKernelArg(ccl_roots_kernel, 1, sizeof(cl_mem), &m_areaMem);
+  errNum |= clSetKernelArg(ccl_roots_kernel, 2, sizeof(cl_mem), &table);
+  errNum |= clSetKernelArg(ccl_roots_kernel, 3, sizeof(cl_int), &m_width);
+  errNum |= clSetKernelArg(ccl_roots_kernel, 4, sizeof(cl_int), &m_height);
+  errNum |= clSetKernelArg(ccl_roots_kernel, 5, sizeof(cl_int), &m_minArea);
+  errNum |= clEnqueueNDRangeKernel(commandQueue, ccl_roots_kernel, 2, NULL, global, local, 0, NULL, NULL);
+
+  errNum |= clSetKernelArg(blob_accumulate_kernel, 0, sizeof(cl_mem), &m_labelMem);
+  errNum |= clSetKernelArg(blob_accumulate_kernel, 1, sizeof(cl_mem), &table);
+  errNum |= clSetKernelArg(blob_accumulate_kernel, 2, sizeof(cl_int), &m_width);
+  errNum |= clSetKernelArg(blob_accumulate_kernel, 3, sizeof(cl_int), &m_height);
+  errNum |= clSetKernelArg(blob_accumulate_kernel, 4, sizeof(cl_int), &maxLabels);
+  errNum |= clEnqueueNDRangeKernel(commandQueue, blob_accumulate_kernel, 2, NULL, global, local, 0, NULL, last);
+  return errNum;
+}
+
+///
+// Mask image and histogram of the mask pass, created on first use :
+// the program switches to a variant with a mask pass asynchronously
+bool ocl_texreadback :: CreateMaskBuffers()
+{
+  cl_int errNum = CL_SUCCESS;
+  if ( !m_maskMem ){
+    // single channel images are optional in OpenCL 1.1
+    cl_image_format format = { CL_R, CL_UNORM_INT8 };
+    m_maskMem = clCreateImage2D(context, CL_MEM_READ_WRITE, &format, m_width, m_height, 0, NULL, &errNum);
+    if ( errNum != CL_SUCCESS ){
+      format.image_channel_order = CL_RGBA;
+      m_maskMem = clCreateImage2D(context, CL_MEM_READ_WRITE, &format, m_width, m_height, 0, NULL, &errNum);
+    }
+    if ( errNum != CL_SUCCESS ){
+      m_maskMem = 0;
+      std::cerr << "Error creating mask image." << std::endl;
+      return false;
+    }
+  }
+  if ( m_programAdaptive == ADAPTIVE_OTSU && !m_histMem ){
+    size_t size = sizeof(cl_uint) * (OCL_HIST_BINS + 1);
+    m_histMem = m_pool.get(context, CL_MEM_READ_WRITE, size);
+    if ( m_histMem == NULL ){
+      std::cerr << "Error creating memory objects." << std::endl;
+      return false;
     }
+    // cleared once here, then by otsu_kernel after every frame
+    std::vector<cl_uint> zero(OCL_HIST_BINS + 1, 0);
+    errNum = clEnqueueWriteBuffer(commandQueue, m_histMem, CL_TRUE, 0, size, &zero[0], 0, NULL, NULL);
+    if ( errNum != CL_SUCCESS ){
+      std::cerr << "Error clearing histogram." << std::endl;
+      return false;
+    }
+  }
+  if ( m_programAdaptive == ADAPTIVE_AVERAGE || m_programAdaptive == ADAPTIVE_GAUSSIAN ){
+    size_t size = sizeof(cl_float) * 2 * m_width * m_height;
+    bool created = false;
+    for ( int i = 0; i < 2; i++ ){
+      if ( m_modelMem[i] ) continue;
+      m_modelMem[i] = m_pool.get(context, CL_MEM_READ_WRITE, size);
+      if ( m_modelMem[i] == NULL ){
+        std::cerr << "Error creating memory objects." << std::endl;
+        return false;
+      }
+      created = true;
+    }
+    if ( created || m_modelReset ){
+      // a negative mean : the first frame starts the model.
+      // both buffers, so that neither holds a stale model after the swap
+      std::vector<cl_float> empty(2 * m_width * m_height, -1.f);
+      errNum = clEnqueueWriteBuffer(commandQueue, m_modelMem[0], CL_TRUE, 0, size, &empty[0], 0, NULL, NULL);
+      errNum |= clEnqueueWriteBuffer(commandQueue, m_modelMem[1], CL_TRUE, 0, size, &empty[0], 0, NULL, NULL);
+      if ( errNum != CL_SUCCESS ){
+        std::cerr << "Error clearing background model." << std::endl;
+        return false;
+      }
+      m_modelReset = false;
+    }
+  }
+  return true;
+}
 
-    errNum = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-    if (errNum != CL_SUCCESS)
-    {
-        // Determine the reason for the error
-        char buildLog[16384];
-        clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG,
-                              sizeof(buildLog), buildLog, NULL);
+///
+// Classify the acquired texture into m_maskMem, with a threshold computed
+// on the device and the morphology fused in : nothing goes back to the
+// host in between. 'first' gets the event of the first kernel (profiling)
+cl_int ocl_texreadback :: enqueueMask(cl_event *first)
+{
+  cl_int errNum = CL_SUCCESS;
+  size_t domain[2] = { (size_t)m_width, (size_t)m_height };
+  size_t global[2];
+
+  if ( m_programAdaptive == ADAPTIVE_OTSU ){
+    size_t local[2] = { 16, 16 };
+    oclRuntime::globalSize(domain, local, global);
+    errNum |= clSetKernelArg(histogram_kernel, 0, sizeof(cl_mem), &cl_tex_mem);
+    errNum |= clSetKernelArg(histogram_kernel, 1, sizeof(cl_mem), &m_histMem);
+    errNum |= clSetKernelArg(histogram_kernel, 2, sizeof(cl_int), &m_width);
+    errNum |= clSetKernelArg(histogram_kernel, 3, sizeof(cl_int), &m_height);
+    errNum |= clSetKernelArg(histogram_kernel, 4, sizeof(cl_int4), &m_roiArg);
+    errNum |= clEnqueueNDRangeKernel(commandQueue, histogram_kernel, 2, NULL, global, local, 0, NULL, first);
+    first = NULL;
+
+    size_t levels = OCL_HIST_BINS;
+    errNum |= clSetKernelArg(otsu_kernel, 0, sizeof(cl_mem), &m_histMem);
+    errNum |= clEnqueueNDRangeKernel(commandQueue, otsu_kernel, 1, NULL, &levels, &levels, 0, NULL, NULL);
+  }
+
+  // the histogram and the background model are only used by
+  // their own variants, NULL otherwise
+  size_t local[2] = { OCL_MASK_TILE, OCL_MASK_TILE };
+  oclRuntime::globalSize(domain, local, global);
+  errNum |= clSetKernelArg(mask_kernel, 0, sizeof(cl_mem), &cl_tex_mem);
+  errNum |= clSetKernelArg(mask_kernel, 1, sizeof(cl_mem), &m_maskMem);
+  errNum |= clSetKernelArg(mask_kernel, 2, sizeof(cl_int), &m_width);
+  errNum |= clSetKernelArg(mask_kernel, 3, sizeof(cl_int), &m_height);
+  errNum |= clSetKernelArg(mask_kernel, 4, sizeof(cl_int4), &m_roiArg);
+  errNum |= clSetKernelArg(mask_kernel, 5, sizeof(cl_mem), &m_histMem);
+  // background model : this frame's is read, the next one's written
+  errNum |= clSetKernelArg(mask_kernel, 6, sizeof(cl_mem), &m_modelMem[m_modelIndex]);
+  errNum |= clSetKernelArg(mask_kernel, 7, sizeof(cl_mem), &m_modelMem[1 - m_modelIndex]);
+  errNum |= clEnqueueNDRangeKernel(commandQueue, mask_kernel, 2, NULL, global, local, 0, NULL, first);
+  if ( m_modelMem[0] ) m_modelIndex = 1 - m_modelIndex;
+  return errNum;
+}
 
-        std::cerr << "Error in kernel: " << std::endl;
-        std::cerr << buildLog;
-        clReleaseProgram(program);
-        return NULL;
+///
+// Work-group size from an earlier autotune, or the defaults
+void ocl_texreadback :: chooseLocalSize(cl_kernel kernel, const size_t domain[2])
+{
+  size_t *local = m_localSize[m_output];
+  if ( m_output == OUTPUT_STATS ){
+    // reqd_work_group_size
+    local[0] = OCL_STATS_GROUP_SIZE;
+    local[1] = 1;
+  } else if ( !m_runtime->storedLocalSize(kernel, domain, local) ){
+    if ( m_output == OUTPUT_PACKED ){
+      local[0] = local[1] = 0;
+    } else {
+      local[0] = 32;
+      local[1] = 4;
     }
+  }
+  m_localSizeKnown[m_output] = true;
+}
+
+void ocl_texreadback :: resetLocalSizes()
+{
+  for ( int i = 0; i < OUTPUT_MODES; i++ )
+    m_localSizeKnown[i] = false;
+}
 
-    return program;
+///
+// GL objects used by a frame : the input texture, and the output one
+int ocl_texreadback :: glObjects(cl_mem objects[2])
+{
+  objects[0] = cl_tex_mem;
+  if ( m_output != OUTPUT_TEXTURE ) return 1;
+  objects[1] = m_outTexMem;
+  return 2;
 }
 
 ///
-//  Create memory objects used as the arguments to kernels in OpenCL
-//  The memory objects are created from existing OpenGL buffers and textures
-//
-bool ocl_texreadback :: CreateMemObjects(cl_context context, GLuint texture, cl_mem *p_cl_tex_mem, cl_mem *p_cl_binBuf_mem)
+// (Re)specify the output texture at the size of the mask and share it
+// with OpenCL : only called while rendering, with the GL context current
+bool ocl_texreadback :: CreateOutputTexture()
+{
+  cl_int errNum;
+  if ( !m_textureObj ) glGenTextures(1, &m_textureObj);
+  glBindTexture(GL_TEXTURE_RECTANGLE_ARB, m_textureObj);
+  glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA8, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+
+  m_outTexMem = clCreateFromGLTexture2D(context, CL_MEM_WRITE_ONLY, GL_TEXTURE_RECTANGLE_ARB, 0, m_textureObj, &errNum);
+  if ( errNum != CL_SUCCESS ){
+    m_outTexMem = 0;
+    std::cerr << "Failed creating memory from GL texture." << std::endl;
+    return false;
+  }
+  return true;
+}
+
+///
+// Send the output texture out, as [extTexture( takes it
+void ocl_texreadback :: outputTexture()
+{
+  t_atom ap[5];
+  SETFLOAT(ap+0, m_textureObj);
+  SETFLOAT(ap+1, m_width);
+  SETFLOAT(ap+2, m_height);
+  SETFLOAT(ap+3, GL_TEXTURE_RECTANGLE_ARB);
+  SETFLOAT(ap+4, m_binaryImage.upsidedown);
+  outlet_list(m_outTexID, 0, 5, ap);
+}
+
+///
+// Hand the GL texture over to OpenCL.
+// With sync objects only the GL commands issued so far have to complete
+// before the kernel runs, and the host does not wait for them at all.
+cl_int ocl_texreadback :: acquireTexture(cl_event *event)
 {
 	cl_int errNum;
-	
-	*p_cl_tex_mem = clCreateFromGLTexture2D(context, CL_MEM_READ_ONLY, GL_TEXTURE_RECTANGLE_ARB, 0, texture, &errNum );
-	if( errNum != CL_SUCCESS )
-	{
-		std::cerr<< "Failed creating memory from GL texture." << std::endl;
-		return false;
+	cl_event glDone = 0;
+	double t0 = sys_getrealtime();
+
+	// the previous fence has been waited for by the previous acquire
+	if ( m_fence ){
+	  glDeleteSync(m_fence);
+	  m_fence = 0;
 	}
-  
-  *p_cl_binBuf_mem = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(bool) * m_width * m_height, NULL, NULL);
 
-  if ( cl_bin_mem == NULL)
-  {
-    std::cerr << "Error creating memory objects." << std::endl;
+	if ( m_glsync && m_createEventFromGLsync ){
+	  m_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	  glFlush();
+	  glDone = m_createEventFromGLsync(context, (cl_GLsync)m_fence, &errNum);
+	  if ( errNum != CL_SUCCESS ) glDone = 0;
+	}
+	if ( !glDone ) glFinish();
+
+	cl_mem objects[2];
+	errNum = clEnqueueAcquireGLObjects(commandQueue, glObjects(objects), objects, glDone ? 1 : 0, glDone ? &glDone : NULL, event );
+	if ( glDone ) clReleaseEvent(glDone);
+
+	double ms = (sys_getrealtime() - t0) * 1000.;
+	if ( m_profile ) m_timings[PROF_HANDOFF].add(ms);
+
+	t_atom ap[2];
+	SETSYMBOL(ap+0, gensym(glDone ? "glsync" : "glfinish"));
+	SETFLOAT(ap+1, ms);
+	outlet_anything(m_infoOut, gensym("handoff"), 2, ap);
+	return errNum;
+}
+
+///
+// Wrap the pix data for the kernels, in place : the image is only created
+// again when Gem hands over another buffer or format
+bool ocl_texreadback :: wrapPix(const imageStruct &image, bool newImage)
+{
+  if ( cl_tex_mem && m_hostData == image.data && m_hostFormat == image.format ){
+    m_hostDirty = m_hostDirty || newImage;
+    return true;
+  }
+  cl_image_format format;
+  format.image_channel_data_type = CL_UNORM_INT8;
+  switch ( image.format ){
+  case GL_RGBA:      format.image_channel_order = CL_RGBA; break;
+  case GL_BGRA_EXT:  format.image_channel_order = CL_BGRA; break;
+  case GL_LUMINANCE: format.image_channel_order = CL_LUMINANCE; break;
+  default:
+    error("input host : only RGBA and grey pix are supported");
+    return false;
+  }
+  if ( cl_tex_mem ){
+    // the kernels of the previous frame may still read the old one
+    clFinish(commandQueue);
+    clReleaseMemObject(cl_tex_mem);
+    cl_tex_mem = 0;
+  }
+  cl_int errNum;
+  cl_tex_mem = clCreateImage2D(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR, &format,
+                               image.xsize, image.ysize, image.xsize * image.csize, image.data, &errNum);
+  if ( errNum != CL_SUCCESS ){
+    cl_tex_mem = 0;
+    m_hostData = NULL;
+    error("input host : Error creating image (%d).", errNum);
     return false;
   }
+  m_hostData = image.data;
+  m_hostFormat = image.format;
+  // read from the host memory as it is now
+  m_hostDirty = false;
   return true;
 }
 
 ///
-//  Cleanup any created OpenCL resources
-//
-void ocl_texreadback :: Cleanup()
+// Gem has written new pixels into the wrapped memory : writing the image
+// from its own host pointer is a no-op on devices sharing host memory,
+// and the upload on the others
+cl_int ocl_texreadback :: acquireHost(cl_event *event)
 {
-    if (commandQueue != 0){
-        clReleaseCommandQueue(commandQueue);
-        commandQueue=0;
-    }
+  if ( !m_hostDirty ) return CL_SUCCESS;
+  m_hostDirty = false;
+  size_t origin[3] = { 0, 0, 0 };
+  size_t region[3] = { (size_t)m_texWidth, (size_t)m_texHeight, 1 };
+  size_t pitch = m_texWidth * (m_hostFormat == GL_LUMINANCE ? 1 : 4);
+  return clEnqueueWriteImage(commandQueue, cl_tex_mem, CL_FALSE, origin, region,
+                             pitch, 0, m_hostData, 0, NULL, event);
+}
 
-    if (program != 0){
-        clReleaseProgram(program);
-        program=0;
-    }
+///
+// Wait for a result buffer to be mapped and hand it to the pix chain
+bool ocl_texreadback :: outputResult(int slot)
+{
+  resultSlot &r = m_ring[slot];
+  if ( !r.ptr || !r.ready ) return false;
 
-    if (context != 0){
-        clReleaseContext(context);
-        context=0;
-    }
+  double t0 = sys_getrealtime();
+  if ( clWaitForEvents(1, &r.ready) != CL_SUCCESS ){
+    error("Error reading result buffer.");
+    return false;
+  }
+  double t1 = sys_getrealtime();
 
-    if( tex_kernel != 0 ){
-      clReleaseKernel(tex_kernel);
-      tex_kernel=0;
-    }
+  bool pix = true;
+  switch ( m_output ){
+  case OUTPUT_STATS:
+    // no pix : the mask statistics go out of the data outlet
+    outputStats((const cl_ulong*)r.ptr);
+    pix = false;
+    break;
+  case OUTPUT_BLOBS:
+    outputBlobs((const cl_uint*)r.ptr);
+    pix = false;
+    break;
+  case OUTPUT_POINTS:
+    outputPoints((const cl_uint*)r.ptr);
+    pix = false;
+    break;
+  case OUTPUT_PACKED:
+    m_binaryImage.copy2ImageStruct(&m_pixBlock.image);
+    oclUnpackMask((const cl_uint*)r.ptr, m_binaryImage.data, m_width, m_height);
+    break;
+  default:
+    // header only, the pixels stay where they are
+    m_binaryImage.copy2ImageStruct(&m_pixBlock.image);
+    m_pixBlock.image.data = r.ptr;
+  }
+  if ( pix ) m_pixBlock.newimage = true;
 
-    if( cl_tex_mem != 0 ){
-      clReleaseMemObject(cl_tex_mem);
-      cl_tex_mem=0;
-    }
+  if ( m_profile ){
+    m_timings[PROF_WAIT].add((t1 - t0) * 1000.);
+    m_timings[PROF_CONVERT].add((sys_getrealtime() - t1) * 1000.);
+    collectProfile(slot);
+    outputProfile();
+  }
+  return pix;
+}
 
-    post("Cleanup() complete");
+///
+// stats <count> <cx> <cy> <xmin> <ymin> <xmax> <ymax> <varx> <vary> <covxy>
+// in pixels of the texture, all 0 for an empty mask
+// (the count is in pixels of the decimated mask)
+void ocl_texreadback :: outputStats(const cl_ulong *v)
+{
+  t_atom ap[OCL_STATS_VALUES];
+  for ( int i = 0; i < OCL_STATS_VALUES; i++ ) SETFLOAT(ap+i, 0);
+
+  // mask -> texture coordinates
+  double ox = m_roiArg.s[0], oy = m_roiArg.s[1], step = m_roiArg.s[2];
+  double n = v[0];
+  if ( n > 0 ){
+    double cx = v[1] / n, cy = v[2] / n;
+    SETFLOAT(ap+0, n);
+    SETFLOAT(ap+1, ox + step * cx);
+    SETFLOAT(ap+2, oy + step * cy);
+    SETFLOAT(ap+3, ox + step * v[6]);
+    SETFLOAT(ap+4, oy + step * v[7]);
+    SETFLOAT(ap+5, ox + step * v[8]);
+    SETFLOAT(ap+6, oy + step * v[9]);
+    // central second moments
+    SETFLOAT(ap+7, step * step * (v[3] / n - cx * cx));
+    SETFLOAT(ap+8, step * step * (v[4] / n - cy * cy));
+    SETFLOAT(ap+9, step * step * (v[5] / n - cx * cy));
+  }
+  outlet_anything(m_dataOut, gensym("stats"), OCL_STATS_VALUES, ap);
 }
 
+struct blobArea {
+  const cl_uint *table;
+  bool operator()(int a, int b) const {
+    return table[a * OCL_BLOB_VALUES] > table[b * OCL_BLOB_VALUES];
+  }
+};
+
 ///
-// Use OpenCL to process texture data
-cl_int ocl_texreadback :: computeTexture()
+// blob <rank> <area> <cx> <cy> <xmin> <ymin> <xmax> <ymax>
+// for the m_maxBlobs largest components of m_minArea pixels or more, then
+// blobs <number of such components>
+// components beyond the OCL_BLOB_LABELS the table holds are not measured :
+// overflow blobs <components> <table size> on the info outlet
+void ocl_texreadback :: outputBlobs(const cl_uint *table)
 {
-	cl_int errNum;
+  int count = table[0];
+  const cl_uint *blobs = table + 1;
+  std::vector<int> order;
+  for ( int i = 0; i < count && i < OCL_BLOB_LABELS; i++ ){
+    order.push_back(i);
+  }
+  if ( count > OCL_BLOB_LABELS ){
+    t_atom ap[3];
+    SETSYMBOL(ap+0, gensym("blobs"));
+    SETFLOAT(ap+1, count);
+    SETFLOAT(ap+2, OCL_BLOB_LABELS);
+    outlet_anything(m_infoOut, gensym("overflow"), 3, ap);
+  }
+  size_t n = std::min(order.size(), (size_t)m_maxBlobs);
+  blobArea larger = { blobs };
+  double ox = m_roiArg.s[0], oy = m_roiArg.s[1], step = m_roiArg.s[2];
+  std::partial_sort(order.begin(), order.begin() + n, order.end(), larger);
 
-    errNum = clSetKernelArg(tex_kernel, 0, sizeof(cl_mem), &cl_tex_mem);
-    errNum = clSetKernelArg(tex_kernel, 1, sizeof(cl_mem), &cl_bin_mem);
-    errNum = clSetKernelArg(tex_kernel, 2, sizeof(cl_int), &m_width);
-    errNum = clSetKernelArg(tex_kernel, 3, sizeof(cl_int), &m_height);
-	
-	size_t tex_globalWorkSize[2] = { m_width, m_height };
-	size_t tex_localWorkSize[2] = { 32, 4 } ;
+  for ( size_t rank = 0; rank < n; rank++ ){
+    const cl_uint *b = blobs + order[rank] * OCL_BLOB_VALUES;
+    double area = b[0];
+    double sumx = b[1] + 4294967296. * b[2];
+    double sumy = b[3] + 4294967296. * b[4];
+    t_atom ap[8];
+    SETFLOAT(ap+0, rank);
+    SETFLOAT(ap+1, area);
+    SETFLOAT(ap+2, ox + step * sumx / area);
+    SETFLOAT(ap+3, oy + step * sumy / area);
+    SETFLOAT(ap+4, ox + step * b[5]);
+    SETFLOAT(ap+5, oy + step * b[6]);
+    SETFLOAT(ap+6, ox + step * b[7]);
+    SETFLOAT(ap+7, oy + step * b[8]);
+    outlet_anything(m_dataOut, gensym("blob"), 8, ap);
+  }
 
-	glFinish();
-	errNum = clEnqueueAcquireGLObjects(commandQueue, 1, &cl_tex_mem, 0, NULL, NULL );
+  t_atom ap;
+  SETFLOAT(&ap, count);
+  outlet_anything(m_dataOut, gensym("blobs"), 1, &ap);
+}
 
-    errNum = clEnqueueNDRangeKernel(commandQueue, tex_kernel, 2, NULL,
-                                    tex_globalWorkSize, tex_localWorkSize,
-                                    0, NULL, NULL);
-    if (errNum != CL_SUCCESS)
-    {
-        std::cerr << "Error queuing kernel for execution." << std::endl;
-    }
-	errNum = clEnqueueReleaseGLObjects(commandQueue, 1, &cl_tex_mem, 0, NULL, NULL );
-  
-	clFinish(commandQueue);
-	return 0;
+///
+// points <count> <x0> <y0> <x1> <y1> ...
+// count is the number of mask pixels, at most m_maxPoints of them are listed
+void ocl_texreadback :: outputPoints(const cl_uint *points)
+{
+  cl_uint count = points[0];
+  int n = std::min(count, (cl_uint)m_maxPoints);
+  int ox = m_roiArg.s[0], oy = m_roiArg.s[1], step = m_roiArg.s[2];
+  std::vector<t_atom> ap(1 + 2 * n);
+  SETFLOAT(&ap[0], count);
+  for ( int k = 0; k < n; k++ ){
+    cl_uint p = points[1 + k];
+    SETFLOAT(&ap[1 + 2*k], ox + step * (int)(p & 0xFFFF));
+    SETFLOAT(&ap[2 + 2*k], oy + step * (int)(p >> 16));
+  }
+  outlet_anything(m_dataOut, gensym("points"), ap.size(), &ap[0]);
+}
+
+///
+// Read the device timestamps of a completed frame
+void ocl_texreadback :: collectProfile(int slot)
+{
+  resultSlot &r = m_ring[slot];
+  // not enqueued on the profiling queue
+  if ( !r.prof[1] ) return;
+
+  if ( r.prof[0] ) m_timings[PROF_ACQUIRE].add(oclRuntime::eventTime(r.prof[0]));
+  // all the kernels of the frame : mask pass, output kernel, follow-ups
+  m_timings[PROF_KERNEL].add(oclRuntime::eventTime(r.prof[1], r.prof[2] ? r.prof[2] : r.prof[1]));
+  if ( r.prof[3] ) m_timings[PROF_RELEASE].add(oclRuntime::eventTime(r.prof[3]));
+  for ( int i = 0; i < 4; i++ ){
+    if ( r.prof[i] ) clReleaseEvent(r.prof[i]);
+    r.prof[i] = 0;
+  }
+  // texture output : nothing is read back
+  if ( r.ready ) m_timings[PROF_READBACK].add(oclRuntime::eventTime(r.ready));
+}
+
+///
+// <stage> <min> <mean> <p99> in ms, for the last frames
+void ocl_texreadback :: outputProfile()
+{
+  static const char *names[PROF_STAGES] = {
+    "handoff", "acquire", "kernel", "release", "readback", "wait", "convert"
+  };
+  for ( int i = 0; i < PROF_STAGES; i++ ){
+    const oclTimings &t = m_timings[i];
+    if ( !t.count() ) continue;
+    t_atom ap[3];
+    SETFLOAT(ap+0, t.min());
+    SETFLOAT(ap+1, t.mean());
+    SETFLOAT(ap+2, t.percentile(99.));
+    outlet_anything(m_profileOut, gensym(names[i]), 3, ap);
+  }
+}
+
+///
+// Switch command queues once everything on the current one is done
+void ocl_texreadback :: useQueue(cl_command_queue queue)
+{
+  if ( queue == commandQueue ) return;
+  if ( commandQueue ) clFinish(commandQueue);
+  commandQueue = queue;
 }
 
 
@@ -323,83 +1001,348 @@ cl_int ocl_texreadback :: computeTexture()
 /////////////////////////////////////////////////////////
 ocl_texreadback :: ocl_texreadback(t_floatarg size)
         : GemShape(size),
+        m_textureObj(0),
         texture(1),
         m_width(-1),
         m_height(-1),
+        m_texWidth(-1),
+        m_texHeight(-1),
+        m_decimate(1),
+        m_threshold(0.5),
+        m_channel(0),
+        m_invert(false),
+        m_adaptive(ADAPTIVE_OFF),
+        m_meanRadius(7),
+        m_meanOffset(0.02),
+        m_bgAlpha(0.05),
+        m_bgK(2.5),
+        m_buildAdaptive(ADAPTIVE_OFF),
+        m_programAdaptive(ADAPTIVE_OFF),
+        m_morph(MORPH_NONE),
+        m_morphRadius(1),
+        m_buildMorph(MORPH_NONE),
+        m_programMorph(MORPH_NONE),
+        m_runtime(NULL),
+        m_build(NULL),
+        m_kernelFile("ocl_texreadback.cl"),
+        m_reloadPending(false),
+        m_watch(false),
+        m_watchFd(-1),
+        m_kernelMtime(0),
         context(0),
         commandQueue(0),
         program(0),
         device(0),
         tex_kernel(0),
+        pack_kernel(0),
+        stats_kernel(0),
+        stats_reduce_kernel(0),
+        m_partialMem(0),
+        ccl_init_kernel(0),
+        ccl_merge_kernel(0),
+        ccl_compress_kernel(0),
+        ccl_area_kernel(0),
+        ccl_roots_kernel(0),
+        blob_clear_kernel(0),
+        blob_accumulate_kernel(0),
+        m_labelMem(0),
+        m_areaMem(0),
+        m_maxBlobs(16),
+        m_minArea(1),
+        points_kernel(0),
+        image_kernel(0),
+        m_outTexMem(0),
+        m_maxPoints(1024),
+        histogram_kernel(0),
+        otsu_kernel(0),
+        mask_kernel(0),
+        m_histMem(0),
+        m_modelIndex(0),
+        m_modelReset(false),
+        m_maskMem(0),
         cl_tex_mem(0),
-        cl_bin_mem(NULL),
-        m_binBuf(NULL),
-        m_binaryImage(NULL)
+        m_input(INPUT_TEXTURE),
+        m_runtimeInput(INPUT_TEXTURE),
+        m_hostData(NULL),
+        m_hostFormat(0),
+        m_hostDirty(false),
+        m_ringIndex(0),
+        m_pipelined(false),
+        m_releaseEvent(0),
+        m_output(OUTPUT_BYTES),
+        m_glsync(true),
+        m_createEventFromGLsync(NULL),
+        m_fence(0),
+        m_profile(false),
+        m_tunePending(false)
 {
   m_opencl_is_init=false;
+  m_modelMem[0] = m_modelMem[1] = 0;
+  for ( int i = 0; i < OCL_RING_SIZE; i++ ){
+    m_ring[i].mem = 0;
+    m_ring[i].ready = 0;
+    m_ring[i].ptr = NULL;
+    for ( int j = 0; j < 4; j++ ) m_ring[i].prof[j] = 0;
+  }
+  resetLocalSizes();
+  for ( int i = 0; i < 4; i++ ){
+    m_roi[i] = 0;
+    m_roiArg.s[i] = 0;
+  }
+  m_roiArg.s[2] = 1;
   
   m_outTexID = outlet_new(this->x_obj, &s_float);
+  m_infoOut = outlet_new(this->x_obj, 0);
+  m_profileOut = outlet_new(this->x_obj, 0);
+  m_dataOut = outlet_new(this->x_obj, 0);
 }
 
 void ocl_texreadback :: initOpenCL(GemState *state)
 {
     if ( m_width < 0 || m_height < 0 ) return;
 
-    // Create an OpenCL context on first available platform
-    context = CreateContext();
-    if (context == NULL)
+    // Share the context of the current GL context with the other ocl objects,
+    // host input needs no GL at all
+    m_runtime = oclRuntime::acquire(m_input != INPUT_HOST);
+    m_runtimeInput = m_input;
+    if (m_runtime == NULL)
     {
         error("Failed to create OpenCL context.");
         m_opencl_is_init = false;
         return;
     }
+    context = m_runtime->context();
+    commandQueue = m_profile ? m_runtime->profilingQueue() : m_runtime->queue();
+    device = m_runtime->device();
 
-    // Create a command-queue on the first device available
-    // on the created context
-    commandQueue = CreateCommandQueue(context, &device);
-    if (commandQueue == NULL)
+    // Create memory objects that will be used as arguments to
+    // kernel
+    if (!CreateMemObjects(context, texture, &cl_tex_mem))
     {
         Cleanup();
-        error("Failed to create command cue.");
+        error("Failed to create mem objects");
         m_opencl_is_init = false;
         return;
     }
 
-    // Create OpenCL program from *.cl kernel source
-    program = CreateProgram(context, device, "ocl_texreadback.cl");
-    if (program == NULL)
+    // Create OpenCL program from *.cl kernel source, built once for all
+    // instances, in the background
+    if (!startBuild())
     {
         Cleanup();
         error("Failed to create program");
         m_opencl_is_init = false;
         return;
     }
+    m_opencl_is_init = true;
+    
+    if ( m_input == INPUT_HOST ){
+      m_createEventFromGLsync = NULL;
+      cl_bool unified = CL_FALSE;
+      clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), &unified, NULL);
+      if ( !unified )
+        post("%s has memory of its own : the pix is copied to it, 'input texture' may be faster",
+             m_runtime->deviceName().c_str());
+      return;
+    }
+    performQueries();
+    queryGLSync();
+}
 
-    tex_kernel = clCreateKernel(program, "process_texture_kernel", NULL);
-    if (tex_kernel == NULL)
-    {
-        Cleanup();
-        error("Failed to create texture kernel");
-        m_opencl_is_init = false;
-        return;
+///
+// Start building the program on the runtime's worker thread
+bool ocl_texreadback :: startBuild()
+{
+  // one build at a time : the next one starts when this one is done
+  if ( m_build ){
+    m_reloadPending = true;
+    return true;
+  }
+  m_reloadPending = false;
+
+  std::string source;
+  if ( !oclRuntime::readFile(m_kernelFile.c_str(), source) )
+    return false;
+
+  m_buildAdaptive = m_adaptive;
+  m_buildMorph = m_morph;
+  m_build = m_runtime->getProgramAsync(source, buildOptions());
+  return true;
+}
+
+///
+// Compile-time parameters of the kernels : every classifier setting
+// is a variant of its own in the runtime's program cache
+std::string ocl_texreadback :: buildOptions()
+{
+  std::ostringstream options;
+  options << "-DSTATS_GROUP_SIZE=" << OCL_STATS_GROUP_SIZE;
+  // always with a decimal point, so that the f suffix makes a float literal
+  options << std::showpoint << std::setprecision(9);
+  options << " -DTHRESHOLD=" << m_threshold << "f";
+  options << " -DCHANNEL=" << m_channel;
+  options << " -DINVERT=" << (m_invert ? 1 : 0);
+  options << " -DADAPTIVE=" << m_adaptive;
+  if ( m_adaptive == ADAPTIVE_MEAN ){
+    options << " -DMEAN_RADIUS=" << m_meanRadius;
+    options << " -DMEAN_OFFSET=" << m_meanOffset << "f";
+  }
+  if ( m_adaptive == ADAPTIVE_AVERAGE || m_adaptive == ADAPTIVE_GAUSSIAN )
+    options << " -DBG_ALPHA=" << m_bgAlpha << "f";
+  if ( m_adaptive == ADAPTIVE_GAUSSIAN )
+    options << " -DBG_K=" << m_bgK << "f";
+  options << " -DMORPH=" << m_morph;
+  if ( m_morph != MORPH_NONE )
+    options << " -DMORPH_RADIUS=" << m_morphRadius;
+  return options.str();
+}
+
+///
+// Switch to the kernels of the current classifier settings :
+// the current ones keep running until the variant is built
+// (right away if it was built before)
+void ocl_texreadback :: respecialize()
+{
+  if ( m_runtime && !startBuild() )
+    error("Failed to read %s", m_kernelFile.c_str());
+}
+
+///
+// Switch to the program once its build is complete
+void ocl_texreadback :: pollBuild()
+{
+  cl_program newProgram;
+  if ( !m_build || !m_runtime->pollProgram(m_build, &newProgram) )
+    return;
+  m_build = NULL;
+  int adaptive = m_buildAdaptive;
+  int morph = m_buildMorph;
+  if ( m_reloadPending ) startBuild();
+
+  // on failure the current kernels keep running
+  if ( newProgram == NULL ){
+    error("Failed to create program%s", program ? ", keeping the previous one" : "");
+    return;
+  }
+
+  struct {
+    const char *name;
+    cl_kernel *kernel;
+  } kernels[] = {
+    { "process_texture_kernel", &tex_kernel },
+    { "pack_texture_kernel", &pack_kernel },
+    { "stats_texture_kernel", &stats_kernel },
+    { "stats_reduce_kernel", &stats_reduce_kernel },
+    { "ccl_init_kernel", &ccl_init_kernel },
+    { "ccl_merge_kernel", &ccl_merge_kernel },
+    { "ccl_compress_kernel", &ccl_compress_kernel },
+    { "ccl_area_kernel", &ccl_area_kernel },
+    { "ccl_roots_kernel", &ccl_roots_kernel },
+    { "blob_clear_kernel", &blob_clear_kernel },
+    { "blob_accumulate_kernel", &blob_accumulate_kernel },
+    { "points_texture_kernel", &points_kernel },
+    { "image_texture_kernel", &image_kernel },
+    { "histogram_kernel", &histogram_kernel },
+    { "otsu_kernel", &otsu_kernel },
+    { "mask_kernel", &mask_kernel },
+  };
+  const int numKernels = sizeof(kernels) / sizeof(kernels[0]);
+  cl_kernel newKernels[numKernels];
+  for ( int i = 0; i < numKernels; i++ ){
+    newKernels[i] = m_runtime->getKernel(newProgram, kernels[i].name);
+    if ( newKernels[i] == NULL ){
+      error("Failed to create kernels");
+      m_runtime->releaseProgram(newProgram);
+      return;
     }
+  }
 
-    // Create memory objects that will be used as arguments to
-    // kernel
-    if (!CreateMemObjects(context, texture, &cl_tex_mem, &cl_bin_mem))
-    {
-        Cleanup();
-        error("Failed to create mem objects");
-        m_opencl_is_init = false;
-        return;
+  if ( program ){
+    // the old kernels may still be referenced by enqueued commands
+    // but those hold their own references : swapping right away is safe
+    m_runtime->releaseProgram(program);
+    post("kernels reloaded from %s", m_kernelFile.c_str());
+  }
+  program = newProgram;
+  for ( int i = 0; i < numKernels; i++ )
+    *kernels[i].kernel = newKernels[i];
+  m_programAdaptive = adaptive;
+  m_programMorph = morph;
+  resetLocalSizes();
+}
+
+///
+// Start watching the kernel source for changes
+// (inotify on Linux, modification time elsewhere)
+bool ocl_texreadback :: startWatch()
+{
+  stopWatch();
+#ifdef __linux__
+  // editors often replace the file rather than rewriting it : watch the directory
+  std::string dir = ".";
+  size_t slash = m_kernelFile.rfind('/');
+  if ( slash != std::string::npos ) dir = m_kernelFile.substr(0, slash);
+
+  m_watchFd = inotify_init();
+  if ( m_watchFd < 0 ) return false;
+  fcntl(m_watchFd, F_SETFL, fcntl(m_watchFd, F_GETFL) | O_NONBLOCK);
+  if ( inotify_add_watch(m_watchFd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0 ){
+    close(m_watchFd);
+    m_watchFd = -1;
+    return false;
+  }
+#endif
+  struct stat st;
+  m_kernelMtime = stat(m_kernelFile.c_str(), &st) == 0 ? st.st_mtime : 0;
+  m_watch = true;
+  return true;
+}
+
+void ocl_texreadback :: stopWatch()
+{
+#ifdef __linux__
+  if ( m_watchFd >= 0 ) close(m_watchFd);
+  m_watchFd = -1;
+#endif
+  m_watch = false;
+}
+
+///
+// Reload the kernels if the source has changed since the last call
+void ocl_texreadback :: checkWatch()
+{
+  if ( !m_watch ) return;
+  bool changed = false;
+#ifdef __linux__
+  size_t slash = m_kernelFile.rfind('/');
+  std::string name = slash == std::string::npos ? m_kernelFile : m_kernelFile.substr(slash+1);
+  char buf[4096];
+  ssize_t len;
+  while ( (len = read(m_watchFd, buf, sizeof(buf))) > 0 ){
+    for ( char *ptr = buf; ptr < buf + len; ){
+      struct inotify_event *event = (struct inotify_event*)ptr;
+      if ( event->len && name == event->name ) changed = true;
+      ptr += sizeof(struct inotify_event) + event->len;
     }
-    m_opencl_is_init = true;
-    
-    performQueries();
+  }
+#else
+  struct stat st;
+  if ( stat(m_kernelFile.c_str(), &st) == 0 && st.st_mtime != m_kernelMtime ){
+    m_kernelMtime = st.st_mtime;
+    changed = true;
+  }
+#endif
+  if ( changed && m_runtime && !startBuild() )
+    error("Failed to read %s", m_kernelFile.c_str());
 }
 
 void ocl_texreadback :: stopRendering(void){
   Cleanup();
+  // the GL context is still current here
+  if ( m_textureObj ){
+    glDeleteTextures(1, &m_textureObj);
+    m_textureObj = 0;
+  }
 }
 
 /////////////////////////////////////////////////////////
@@ -408,9 +1351,27 @@ void ocl_texreadback :: stopRendering(void){
 /////////////////////////////////////////////////////////
 ocl_texreadback :: ~ocl_texreadback()
 {
+  stopWatch();
   Cleanup();
 }
 
+///
+// Clip the region of interest to the texture, and get the size of the mask
+void ocl_texreadback :: computeRoi(int texWidth, int texHeight, int &width, int &height)
+{
+  int x = std::max(0, std::min(m_roi[0], texWidth - 1));
+  int y = std::max(0, std::min(m_roi[1], texHeight - 1));
+  int w = texWidth - x, h = texHeight - y;
+  if ( m_roi[2] > 0 ) w = std::min(m_roi[2], w);
+  if ( m_roi[3] > 0 ) h = std::min(m_roi[3], h);
+
+  m_roiArg.s[0] = x;
+  m_roiArg.s[1] = y;
+  m_roiArg.s[2] = m_decimate;
+  width = (w + m_decimate - 1) / m_decimate;
+  height = (h + m_decimate - 1) / m_decimate;
+}
+
 /////////////////////////////////////////////////////////
 // renderShape
 //
@@ -421,69 +1382,348 @@ void ocl_texreadback :: renderShape(GemState *state)
     
     pixBlock *pix;
     state->get(GemState::_PIX, pix);
-    int size=m_width * m_height;
     
     if ( !pix ) return;
     
-    if ( m_width != pix->image.xsize || m_height != pix->image.ysize ){
-      // release previous data
-      if (m_binaryImage)  {
-        m_binaryImage->clear();
-        delete m_binaryImage;
-        m_binaryImage = NULL;
-      }
-      m_binaryImage = new imageStruct;
-      m_width = pix->image.xsize;
-      m_height = pix->image.ysize;
-      m_binaryImage->xsize = m_width;
-      m_binaryImage->ysize = m_height;
-      m_binaryImage->setCsizeByFormat(GL_LUMINANCE);
-      m_binaryImage->upsidedown = pix->image.upsidedown;
-
-      m_binaryImage->allocate(m_binaryImage->xsize * m_binaryImage->ysize * m_binaryImage->csize);
-      
-      size = m_width * m_height;
-      
-      if ( m_binBuf ){
-        delete m_binBuf;
-        m_binBuf=NULL;
+    if ( m_opencl_is_init && m_runtimeInput != m_input ){
+      // another runtime, see inputMess()
+      Cleanup();
+      m_hostData = NULL;
+    }
+
+    int width, height;
+    computeRoi(pix->image.xsize, pix->image.ysize, width, height);
+    if ( m_texWidth != pix->image.xsize || m_texHeight != pix->image.ysize ||
+         m_width != width || m_height != height ){
+      m_texWidth = pix->image.xsize;
+      m_texHeight = pix->image.ysize;
+      m_width = width;
+      m_height = height;
+      resetLocalSizes();
+      m_binaryImage.xsize = m_width;
+      m_binaryImage.ysize = m_height;
+      m_binaryImage.setCsizeByFormat(GL_LUMINANCE);
+      m_binaryImage.upsidedown = pix->image.upsidedown;
+
+      // only written to when unpacking, bytes are output straight from the mapped buffer.
+      // only grows : going back to a smaller size does not reallocate
+      m_binaryImage.reallocate(m_binaryImage.xsize * m_binaryImage.ysize * m_binaryImage.csize);
+
+      if ( m_opencl_is_init && !ResizeMemObjects() ){
+        error("Failed to create mem objects");
+        Cleanup();
+        return;
       }
-      m_binBuf = new bool[m_width * m_height];
     }
     
     if ( !m_opencl_is_init ){
       initOpenCL(state);
-      //~error("OpenCL is not initialized properly");
-      return;
+      if ( !m_opencl_is_init ) return;
     }
+
+    // the program is built in the background : until it is ready
+    // the pix goes through untouched.
+    // reloaded kernels are swapped in here, between two frames
+    checkWatch();
+    pollBuild();
+    if ( !tex_kernel ) return;
     
-    computeTexture();
-    
-    errNum = clEnqueueReadBuffer(commandQueue, cl_bin_mem, CL_TRUE,
-                                 0, size * sizeof(bool), m_binBuf,
-                                 0, NULL, NULL);
+    if ( m_input == INPUT_HOST && !wrapPix(pix->image, pix->newimage) ) return;
+
+    // autotuning needs timestamps
+    bool tune = m_tunePending;
+    if ( tune ) useQueue(m_runtime->profilingQueue());
+
+    int slot = m_ringIndex;
+    errNum = computeTexture();
+    if ( tune && !m_profile ) useQueue(m_runtime->queue());
+    m_ringIndex = (m_ringIndex + 1) % OCL_RING_SIZE;
     if (errNum != CL_SUCCESS)
     {
-        error("Error reading result buffer.");
-    } else {
-      
-      if ( m_binaryImage == NULL ){
-        error("can't get image pointer\n");
+        error("Error mapping result buffer.");
         return;
+    }
+
+    if ( m_output == OUTPUT_TEXTURE ){
+      // GL must not sample the texture before the kernel is done with it,
+      // cl_khr_gl_event makes the release implicitly synchronized with GL
+      // profiling : the timestamps are there once the release is done
+      if ( m_releaseEvent && ( !m_createEventFromGLsync || m_profile ) ) clWaitForEvents(1, &m_releaseEvent);
+      outputTexture();
+      if ( m_profile ){
+        collectProfile(slot);
+        outputProfile();
       }
-      
-      unsigned char* ptr = m_binaryImage->data;
-      for ( int i = 0; i < size; i++ ){
-          ptr[i] = m_binBuf[i]*255;
-      }
-      m_pixBlock.image = *m_binaryImage;
-      m_pixBlock.newimage = true;
+      return;
     }
-    state->set(GemState::_PIX, &m_pixBlock);
+
+    if ( m_pipelined ){
+      // GL may modify the texture as soon as we return, so the kernel has to be
+      // done with it; the readback itself keeps running during the next frame.
+      // cl_khr_gl_event makes the release implicitly synchronized with GL
+      if ( m_releaseEvent && !m_createEventFromGLsync ) clWaitForEvents(1, &m_releaseEvent);
+      // output the previous frame, its readback has had a whole frame to complete
+      slot = (slot + OCL_RING_SIZE - 1) % OCL_RING_SIZE;
+    }
+
+    // nothing to output yet on the first pipelined frame : pass the pix through
+    if ( outputResult(slot) )
+      state->set(GemState::_PIX, &m_pixBlock);
 }
 
 void ocl_texreadback :: obj_setupCallback(t_class *classPtr){
   CPPEXTERN_MSG (classPtr, "extTexture", extTextureMess);
+  CPPEXTERN_MSG1(classPtr, "output", outputMess, t_symbol*);
+  CPPEXTERN_MSG1(classPtr, "input", inputMess, t_symbol*);
+  CPPEXTERN_MSG1(classPtr, "readback", readbackMess, t_symbol*);
+  CPPEXTERN_MSG1(classPtr, "glsync", glsyncMess, bool);
+  CPPEXTERN_MSG0(classPtr, "cache", cacheMess);
+  CPPEXTERN_MSG0(classPtr, "reload", reloadMess);
+  CPPEXTERN_MSG1(classPtr, "watch", watchMess, bool);
+  CPPEXTERN_MSG1(classPtr, "profile", profileMess, bool);
+  CPPEXTERN_MSG0(classPtr, "autotune", autotuneMess);
+  CPPEXTERN_MSG1(classPtr, "maxblobs", maxblobsMess, int);
+  CPPEXTERN_MSG1(classPtr, "minarea", minareaMess, int);
+  CPPEXTERN_MSG1(classPtr, "maxpoints", maxpointsMess, int);
+  CPPEXTERN_MSG (classPtr, "roi", roiMess);
+  CPPEXTERN_MSG1(classPtr, "decimate", decimateMess, int);
+  CPPEXTERN_MSG1(classPtr, "threshold", thresholdMess, t_float);
+  CPPEXTERN_MSG1(classPtr, "channel", channelMess, t_symbol*);
+  CPPEXTERN_MSG1(classPtr, "invert", invertMess, bool);
+  CPPEXTERN_MSG (classPtr, "adaptive", adaptiveMess);
+  CPPEXTERN_MSG (classPtr, "morph", morphMess);
+}
+
+void ocl_texreadback :: roiMess(t_symbol*s, int argc, t_atom*argv)
+{
+  // the new size is picked up by the next frame
+  if ( argc == 0 ){
+    for ( int i = 0; i < 4; i++ ) m_roi[i] = 0;
+    return;
+  }
+  if ( argc != 4 ){
+    error("arguments: [<x> <y> <width> <height>]");
+    return;
+  }
+  for ( int i = 0; i < 4; i++ ){
+    m_roi[i] = atom_getint(argv+i);
+    if ( m_roi[i] < 0 ) m_roi[i] = 0;
+  }
+}
+
+void ocl_texreadback :: thresholdMess(t_float threshold)
+{
+  if ( threshold == m_threshold ) return;
+  m_threshold = threshold;
+  respecialize();
+}
+
+void ocl_texreadback :: channelMess(t_symbol*s)
+{
+  int channel = 0;
+  while ( channel < s_numChannels && s != gensym(s_channelNames[channel]) ) channel++;
+  if ( channel == s_numChannels ){
+    error("channel must be 'r', 'g', 'b', 'a', 'luma' or 'value'");
+    return;
+  }
+  if ( channel == m_channel ) return;
+  m_channel = channel;
+  respecialize();
+}
+
+void ocl_texreadback :: invertMess(bool state)
+{
+  if ( state == m_invert ) return;
+  m_invert = state;
+  respecialize();
+}
+
+void ocl_texreadback :: adaptiveMess(t_symbol*s, int argc, t_atom*argv)
+{
+  if ( argc < 1 || argc > 3 || argv[0].a_type != A_SYMBOL ){
+    error("arguments: off|otsu|mean [<radius> [<offset>]]|average [<alpha>]|gaussian [<alpha> [<k>]]");
+    return;
+  }
+  t_symbol *name = atom_getsymbol(argv);
+  int adaptive = 0;
+  while ( adaptive < ADAPTIVE_MODES && name != gensym(s_adaptiveNames[adaptive]) ) adaptive++;
+  if ( adaptive == ADAPTIVE_MODES ){
+    error("adaptive mode must be 'off', 'otsu', 'mean', 'average' or 'gaussian'");
+    return;
+  }
+  m_adaptive = adaptive;
+  if ( adaptive == ADAPTIVE_MEAN ){
+    if ( argc > 1 ){
+      // the local memory of the kernel is sized for the tile and its halo
+      m_meanRadius = atom_getint(argv+1);
+      if ( m_meanRadius < 1 ) m_meanRadius = 1;
+      if ( m_meanRadius > OCL_MEAN_RADIUS_MAX ) m_meanRadius = OCL_MEAN_RADIUS_MAX;
+    }
+    if ( argc > 2 ) m_meanOffset = atom_getfloat(argv+2);
+  } else if ( adaptive == ADAPTIVE_AVERAGE || adaptive == ADAPTIVE_GAUSSIAN ){
+    if ( argc > 1 ){
+      m_bgAlpha = atom_getfloat(argv+1);
+      if ( m_bgAlpha < 0.001 ) m_bgAlpha = 0.001;
+      if ( m_bgAlpha > 1 ) m_bgAlpha = 1;
+    }
+    if ( argc > 2 ) m_bgK = atom_getfloat(argv+2);
+    // learn the background again, from the next frame on
+    m_modelReset = true;
+  }
+  respecialize();
+}
+
+void ocl_texreadback :: morphMess(t_symbol*s, int argc, t_atom*argv)
+{
+  if ( argc < 1 || argc > 2 || argv[0].a_type != A_SYMBOL ){
+    error("arguments: none|erode|dilate|open|close [<radius>]");
+    return;
+  }
+  t_symbol *name = atom_getsymbol(argv);
+  int morph = 0;
+  while ( morph < MORPH_MODES && name != gensym(s_morphNames[morph]) ) morph++;
+  if ( morph == MORPH_MODES ){
+    error("morph must be 'none', 'erode', 'dilate', 'open' or 'close'");
+    return;
+  }
+  m_morph = morph;
+  if ( argc > 1 ){
+    // the halo in local memory grows with the radius
+    m_morphRadius = atom_getint(argv+1);
+    if ( m_morphRadius < 1 ) m_morphRadius = 1;
+    if ( m_morphRadius > OCL_MORPH_RADIUS_MAX ) m_morphRadius = OCL_MORPH_RADIUS_MAX;
+  }
+  respecialize();
+}
+
+void ocl_texreadback :: decimateMess(int step)
+{
+  if ( step < 1 ) step = 1;
+  m_decimate = step;
+}
+
+void ocl_texreadback :: maxpointsMess(int count)
+{
+  if ( count < 1 ) count = 1;
+  if ( count == m_maxPoints ) return;
+  m_maxPoints = count;
+
+  // the list is part of the result buffers
+  if ( m_opencl_is_init && m_output == OUTPUT_POINTS ){
+    ReleaseResultBuffers();
+    if ( !CreateResultBuffers() ){
+      error("Error creating memory objects.");
+      m_opencl_is_init = false;
+    }
+  }
+}
+
+void ocl_texreadback :: maxblobsMess(int count)
+{
+  if ( count < 0 ) count = 0;
+  m_maxBlobs = count;
+}
+
+void ocl_texreadback :: minareaMess(int area)
+{
+  if ( area < 1 ) area = 1;
+  m_minArea = area;
+}
+
+void ocl_texreadback :: autotuneMess(void)
+{
+  m_tunePending = true;
+}
+
+void ocl_texreadback :: profileMess(bool state)
+{
+  if ( state && !m_profile ){
+    for ( int i = 0; i < PROF_STAGES; i++ )
+      m_timings[i].clear();
+  }
+  m_profile = state;
+  if ( m_runtime )
+    useQueue(m_profile ? m_runtime->profilingQueue() : m_runtime->queue());
+}
+
+void ocl_texreadback :: reloadMess(void)
+{
+  // without a context, the next init will read the file anyway
+  if ( !m_runtime ) return;
+  if ( !startBuild() )
+    error("Failed to read %s", m_kernelFile.c_str());
+}
+
+void ocl_texreadback :: watchMess(bool state)
+{
+  if ( !state ){
+    stopWatch();
+  } else if ( !startWatch() ){
+    error("Failed to watch %s", m_kernelFile.c_str());
+  }
+}
+
+void ocl_texreadback :: cacheMess(void)
+{
+  t_atom ap[2];
+  SETFLOAT(ap+0, oclRuntime::binaryCacheHits());
+  SETFLOAT(ap+1, oclRuntime::binaryCacheMisses());
+  outlet_anything(m_infoOut, gensym("cache"), 2, ap);
+}
+
+void ocl_texreadback :: glsyncMess(bool state)
+{
+  m_glsync = state;
+}
+
+void ocl_texreadback :: readbackMess(t_symbol*s)
+{
+  if ( s == gensym("exact") ) m_pipelined = false;
+  else if ( s == gensym("pipelined") ) m_pipelined = true;
+  else error("readback mode must be 'exact' or 'pipelined'");
+}
+
+void ocl_texreadback :: outputMess(t_symbol*s)
+{
+  int output = 0;
+  while ( output < OUTPUT_MODES && s != gensym(s_outputNames[output]) ) output++;
+  if ( output == OUTPUT_MODES ){
+    error("output mode must be 'bytes', 'packed', 'stats', 'blobs', 'points' or 'texture'");
+    return;
+  }
+  if ( output == m_output ) return;
+  if ( output == OUTPUT_TEXTURE && m_input == INPUT_HOST ){
+    error("output texture needs 'input texture'");
+    return;
+  }
+  m_output = output;
+
+  // result buffer size depends on the output mode
+  if ( m_opencl_is_init ){
+    ReleaseResultBuffers();
+    if ( !CreateResultBuffers() ){
+      error("Error creating memory objects.");
+      m_opencl_is_init = false;
+    }
+  }
+}
+
+void ocl_texreadback :: inputMess(t_symbol*s)
+{
+  int input = 0;
+  while ( input < INPUT_MODES && s != gensym(s_inputNames[input]) ) input++;
+  if ( input == INPUT_MODES ){
+    error("input mode must be 'texture' or 'host'");
+    return;
+  }
+  if ( input == m_input ) return;
+  if ( input == INPUT_HOST && m_output == OUTPUT_TEXTURE ){
+    error("input host cannot output a texture");
+    return;
+  }
+  // another runtime (with or without GL) : everything is created again
+  // on the next frame, see renderShape()
+  m_input = input;
 }
 
 void ocl_texreadback :: extTextureMess(t_symbol*s, int argc, t_atom*argv)
@@ -20,16 +20,36 @@ LOG
 #include "Gem/Exception.h"
 #include "Gem/Image.h"
 
+#include "ocl_runtime.hpp"
+
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <ctime>
+
+// number of result buffers cycled through in pipelined mode
+#define OCL_RING_SIZE 3
+// work-group size of the statistics reduction (STATS_GROUP_SIZE in the kernels)
+#define OCL_STATS_GROUP_SIZE 64
+// count, sum x, sum y, sum xx, sum yy, sum xy, min x, min y, max x, max y
+#define OCL_STATS_VALUES 10
+// labelled components of minarea pixels or more measured per frame, and
+// uints per component :
+// area, sum x (lo, hi), sum y (lo, hi), min x, min y, max x, max y
+#define OCL_BLOB_LABELS 4096
+#define OCL_BLOB_VALUES 9
+// levels of the Otsu histogram (HIST_BINS in the kernels), the level found
+// is stored after them
+#define OCL_HIST_BINS 256
+// work-group size of the mask pass (MASK_TILE x MASK_TILE), and the
+// largest local mean and structuring element radii its local memory
+// is sized for
+#define OCL_MASK_TILE 16
+#define OCL_MEAN_RADIUS_MAX 16
+#define OCL_MORPH_RADIUS_MAX 4
 
-#ifdef __APPLE__
-#include <OpenCL/cl.h>
-#else
-#include <CL/cl.h>
-#include <CL/cl_gl.h>
-#endif
+// cl_khr_gl_event entry point, fetched at runtime
+typedef cl_event (CL_API_CALL *ocl_clCreateEventFromGLsyncKHR_fn)(cl_context, cl_GLsync, cl_int*);
 
 
 /*-----------------------------------------------------------------
@@ -56,6 +76,25 @@ class GEM_EXTERN ocl_texreadback : public GemShape
     	ocl_texreadback(t_floatarg size);
       
       void extTextureMess(t_symbol*, int, t_atom*);
+      void outputMess(t_symbol*);
+      void inputMess(t_symbol*);
+      void readbackMess(t_symbol*);
+      void glsyncMess(bool);
+      void cacheMess(void);
+      void reloadMess(void);
+      void watchMess(bool);
+      void profileMess(bool);
+      void autotuneMess(void);
+      void maxblobsMess(int);
+      void minareaMess(int);
+      void maxpointsMess(int);
+      void roiMess(t_symbol*, int, t_atom*);
+      void decimateMess(int);
+      void thresholdMess(t_float);
+      void channelMess(t_symbol*);
+      void invertMess(bool);
+      void adaptiveMess(t_symbol*, int, t_atom*);
+      void morphMess(t_symbol*, int, t_atom*);
 
     protected:
 
@@ -66,10 +105,11 @@ class GEM_EXTERN ocl_texreadback : public GemShape
     	//////////
     	// Do the rendering
     	virtual void 	renderShape(GemState *state);
-      cl_context CreateContext();
-      cl_command_queue CreateCommandQueue(cl_context context, cl_device_id *device);
-      cl_program CreateProgram(cl_context context, cl_device_id device, const char* fileName);
-      bool CreateMemObjects(cl_context context, GLuint texture, cl_mem *p_cl_tex_mem,  cl_mem *p_cl_binBuf_mem);
+      bool CreateMemObjects(cl_context context, GLuint texture, cl_mem *p_cl_tex_mem);
+      bool CreateResultBuffers();
+      bool ResizeMemObjects();
+      void ReleaseResultBuffers();
+      size_t binBufSize();
       void Cleanup();
              
              
@@ -84,29 +124,236 @@ class GEM_EXTERN ocl_texreadback : public GemShape
        GLuint	    m_extTextureObj;
 
       t_outlet	*m_outTexID;
+      t_outlet	*m_infoOut;
+      t_outlet	*m_profileOut;
+      t_outlet	*m_dataOut;
 
     
     private:
     
       void performQueries();
+      bool startBuild();
+      void pollBuild();
+      bool startWatch();
+      void stopWatch();
+      void checkWatch();
+      void queryGLSync();
+      cl_int acquireTexture(cl_event *event);
+      bool wrapPix(const imageStruct &image, bool newImage);
+      cl_int acquireHost(cl_event *event);
       cl_int computeTexture();
+      void unmapResult(int slot);
+      bool outputResult(int slot);
+      void useQueue(cl_command_queue queue);
+      cl_kernel outputKernel();
+      size_t statsGroups();
+      void outputStats(const cl_ulong *v);
+      cl_int enqueueBlobs(cl_mem table, const size_t global[2], const size_t *local, cl_event *last);
+      void outputBlobs(const cl_uint *table);
+      void outputPoints(const cl_uint *points);
+      bool CreateMaskBuffers();
+      bool CreateOutputTexture();
+      int glObjects(cl_mem objects[2]);
+      void outputTexture();
+      cl_int enqueueMask(cl_event *first);
+      std::string buildOptions();
+      void respecialize();
+      void resetLocalSizes();
+      void computeRoi(int texWidth, int texHeight, int &width, int &height);
+      void chooseLocalSize(cl_kernel kernel, const size_t domain[2]);
+      void collectProfile(int slot);
+      void outputProfile();
       
       GLuint texture;
+      // size of the mask : the region of interest, decimated
       int m_width, m_height;
+      int m_texWidth, m_texHeight;
+      // requested region (x, y, width, height; 0 size : up to the border)
+      // and decimation
+      int m_roi[4];
+      int m_decimate;
+      // clipped region passed to the kernels : x, y, step
+      cl_int4 m_roiArg;
+      // classification of a pixel, compiled into the kernels :
+      // channel (r, g, b, a, luma, value) above threshold, or below if inverted
+      t_float m_threshold;
+      int m_channel;
+      bool m_invert;
+      // threshold computed on the device, per frame (otsu) or per pixel (mean),
+      // or difference to a background model learnt on the device (average,
+      // gaussian)
+      enum adaptiveMode {
+        ADAPTIVE_OFF,
+        ADAPTIVE_OTSU,
+        ADAPTIVE_MEAN,
+        ADAPTIVE_AVERAGE,
+        ADAPTIVE_GAUSSIAN,
+        ADAPTIVE_MODES
+      };
+      int m_adaptive;
+      // neighbourhood and offset of the local mean
+      int m_meanRadius;
+      t_float m_meanOffset;
+      // learning rate of the background, and foreground distance in
+      // standard deviations (gaussian)
+      t_float m_bgAlpha;
+      t_float m_bgK;
+      // mode of the build in progress, and of the current program :
+      // the kernels keep running with the mode they were built for
+      int m_buildAdaptive;
+      int m_programAdaptive;
+      // clean-up of the mask, with a square structuring element
+      enum morphMode {
+        MORPH_NONE,
+        MORPH_ERODE,
+        MORPH_DILATE,
+        MORPH_OPEN,
+        MORPH_CLOSE,
+        MORPH_MODES
+      };
+      int m_morph;
+      int m_morphRadius;
+      int m_buildMorph;
+      int m_programMorph;
       GLint m_extType;
       GLboolean m_extUpsidedown;
 
+      // shared context, queue and device, owned by the runtime
+      oclRuntime *m_runtime;
+      // program being built in the background
+      oclRuntime::buildJob *m_build;
+      std::string m_kernelFile;
+      // reload requested while a build was running
+      bool m_reloadPending;
+      // rebuild when m_kernelFile changes
+      bool m_watch;
+      int m_watchFd;
+      time_t m_kernelMtime;
       cl_context context;
       cl_command_queue commandQueue;
       cl_program program;
       cl_device_id device;
       cl_kernel tex_kernel;
+      cl_kernel pack_kernel;
+      cl_kernel stats_kernel;
+      cl_kernel stats_reduce_kernel;
+      // per work-group partial statistics
+      cl_mem m_partialMem;
+      cl_kernel ccl_init_kernel;
+      cl_kernel ccl_merge_kernel;
+      cl_kernel ccl_compress_kernel;
+      cl_kernel ccl_area_kernel;
+      cl_kernel ccl_roots_kernel;
+      cl_kernel blob_clear_kernel;
+      cl_kernel blob_accumulate_kernel;
+      // union-find labels, one int per pixel, and the area of each root
+      cl_mem m_labelMem;
+      cl_mem m_areaMem;
+      // largest components output per frame, and their minimum area
+      int m_maxBlobs;
+      int m_minArea;
+      cl_kernel points_kernel;
+      cl_kernel image_kernel;
+      // texture output : m_textureObj shared with OpenCL
+      cl_mem m_outTexMem;
+      // size of the coordinate list read back
+      int m_maxPoints;
+      cl_kernel histogram_kernel;
+      cl_kernel otsu_kernel;
+      cl_kernel mask_kernel;
+      // mask pass : histogram and level, and the mask read by the
+      // output kernels
+      cl_mem m_histMem;
+      // background model, mean and variance per pixel : read from
+      // m_modelMem[m_modelIndex], written to the other one, swapped every frame
+      cl_mem m_modelMem[2];
+      int m_modelIndex;
+      bool m_modelReset;
+      cl_mem m_maskMem;
       cl_mem cl_tex_mem;
-      cl_mem cl_bin_mem;
+
+      // what the kernels read :
+      // texture : the GL texture, shared with OpenCL
+      // host : the pix data itself, wrapped with CL_MEM_USE_HOST_PTR.
+      //   no GL interop : zero copy on CPU devices and integrated GPUs
+      enum inputMode {
+        INPUT_TEXTURE,
+        INPUT_HOST,
+        INPUT_MODES
+      };
+      int m_input;
+      // the input the runtime was acquired for
+      int m_runtimeInput;
+      // the pix data cl_tex_mem wraps, and whether it changed since the
+      // kernels last saw it
+      unsigned char *m_hostData;
+      GLenum m_hostFormat;
+      bool m_hostDirty;
+
+      // result buffers : frame N is computed into m_ring[N % OCL_RING_SIZE]
+      struct resultSlot {
+        cl_mem mem;
+        cl_event ready;       // completion of the non-blocking map
+        unsigned char *ptr;   // host view while mapped
+        // profiling only : acquire, first and last kernel (0 when the
+        // first is the only one), release
+        cl_event prof[4];
+      };
+      resultSlot m_ring[OCL_RING_SIZE];
+      int m_ringIndex;
+      // output frame N-1 while frame N is in flight
+      bool m_pipelined;
+      cl_event m_releaseEvent;
       
       bool m_opencl_is_init;
-      bool *m_binBuf;
-      imageStruct *m_binaryImage;
+
+      // what is read back :
+      // bytes : the mask as GL_LUMINANCE pix
+      // packed : 1 bit per pixel, rows padded to 32 bits, unpacked on the host
+      // stats : count, centroid, bounding box and second moments of the mask
+      // blobs : area, centroid and bounding box of the largest components
+      // points : coordinates of the mask pixels, up to m_maxPoints
+      // texture : the mask into m_textureObj, nothing is read back
+      enum outputMode {
+        OUTPUT_BYTES,
+        OUTPUT_PACKED,
+        OUTPUT_STATS,
+        OUTPUT_BLOBS,
+        OUTPUT_POINTS,
+        OUTPUT_TEXTURE,
+        OUTPUT_MODES
+      };
+      int m_output;
+
+      // GL -> CL handoff : GL fence turned into a cl_event (cl_khr_gl_event)
+      // instead of a full glFinish()
+      bool m_glsync;
+      ocl_clCreateEventFromGLsyncKHR_fn m_createEventFromGLsync;
+      GLsync m_fence;
+
+      // per stage timings, on the runtime's profiling queue
+      enum {
+        PROF_HANDOFF,   // host : glFinish() or fence
+        PROF_ACQUIRE,
+        PROF_KERNEL,
+        PROF_RELEASE,
+        PROF_READBACK,  // map of the result buffer
+        PROF_WAIT,      // host : waiting for the readback
+        PROF_CONVERT,   // host : unpacking / output
+        PROF_STAGES
+      };
+      bool m_profile;
+      oclTimings m_timings[PROF_STAGES];
+
+      // work-group size of the kernel of each output mode,
+      // {0, 0} lets the driver choose
+      size_t m_localSize[OUTPUT_MODES][2];
+      bool m_localSizeKnown[OUTPUT_MODES];
+      // time the candidate sizes on the next frame
+      bool m_tunePending;
+      // result buffers of the sizes seen so far
+      oclBufferPool m_pool;
+      imageStruct m_binaryImage;
       pixBlock m_pixBlock;
       
 };